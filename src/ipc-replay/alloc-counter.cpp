@@ -0,0 +1,89 @@
+/*
+ * Preloaded into the client by wf-ipc-replay to count its heap allocations.
+ *
+ * The counters live in the file named by $WF_IPC_REPLAY_ALLOC_FILE, mapped
+ * shared, so the replay tool can read them even though the client is
+ * terminated by a signal and never runs its exit handlers. C++ allocations
+ * go through malloc as well, so they are included.
+ */
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+
+#include "alloc-counter.hpp"
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+
+static wf_ipc_replay_alloc_stats_t *stats = nullptr;
+
+__attribute__((constructor)) static void alloc_counter_init()
+{
+    const char *path = getenv(WF_IPC_REPLAY_ALLOC_FILE_ENV);
+    if (!path)
+    {
+        return;
+    }
+
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    void *data = mmap(nullptr, sizeof(wf_ipc_replay_alloc_stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+        0);
+    close(fd);
+    if (data != MAP_FAILED)
+    {
+        stats = (wf_ipc_replay_alloc_stats_t*)data;
+    }
+
+    // Children of the client count into their own files, if at all
+    unsetenv(WF_IPC_REPLAY_ALLOC_FILE_ENV);
+}
+
+static void count_allocation(size_t size)
+{
+    if (stats)
+    {
+        __atomic_fetch_add(&stats->allocations, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats->bytes, size, __ATOMIC_RELAXED);
+    }
+}
+
+extern "C" {
+void *malloc(size_t size)
+{
+    count_allocation(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    count_allocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    count_allocation(size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (ptr && stats)
+    {
+        __atomic_fetch_add(&stats->frees, 1, __ATOMIC_RELAXED);
+    }
+
+    __libc_free(ptr);
+}
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+/* Names the file the preloaded allocation counter of the client writes to */
+#define WF_IPC_REPLAY_ALLOC_FILE_ENV "WF_IPC_REPLAY_ALLOC_FILE"
+
+/* Layout of that file, updated atomically by the client */
+struct wf_ipc_replay_alloc_stats_t
+{
+    uint64_t allocations;
+    uint64_t frees;
+    /* Requested, not counting what realloc() already held */
+    uint64_t bytes;
+};
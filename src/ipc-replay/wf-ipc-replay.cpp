@@ -0,0 +1,832 @@
+/*
+ * Records Wayfire IPC traffic to a trace and replays it from a fake server,
+ * so the IPC-driven widgets can be benchmarked without a compositor.
+ *
+ * A trace has one JSON object per line:
+ *   {"time-ms": 12.5, "from": "client" or "server", "message": {...}}
+ */
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <wayfire/nonstd/json.hpp>
+
+#include "alloc-counter.hpp"
+
+using steady_clock = std::chrono::steady_clock;
+
+struct trace_entry_t
+{
+    double time_ms;
+    bool from_client;
+    wf::json_t message;
+};
+
+static double ms_since(steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+template<class Json>
+static double as_number(const Json& value)
+{
+    if (value.is_int())
+    {
+        return value.as_int();
+    }
+
+    return value.as_double();
+}
+
+static bool read_all(int fd, char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t received = ::recv(fd, data, size, 0);
+        if (received < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        if (received == 0)
+        {
+            return false;
+        }
+
+        data += received;
+        size -= received;
+    }
+
+    return true;
+}
+
+static bool write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+static bool read_frame(int fd, std::string& frame)
+{
+    uint32_t length;
+    if (!read_all(fd, (char*)&length, sizeof(length)))
+    {
+        return false;
+    }
+
+    frame.resize(length);
+    return read_all(fd, frame.data(), length);
+}
+
+static bool write_frame(int fd, const std::string& frame)
+{
+    uint32_t length = frame.size();
+    return write_all(fd, (const char*)&length, sizeof(length)) && write_all(fd, frame.data(), length);
+}
+
+static int listen_on(const std::string& path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if ((fd < 0) || (path.size() >= sizeof(addr.sun_path)))
+    {
+        std::cerr << "Cannot create socket " << path << std::endl;
+        return -1;
+    }
+
+    strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+    if ((bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) || (listen(fd, 1) < 0))
+    {
+        std::cerr << "Cannot listen on " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int connect_to(const std::string& path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if ((fd < 0) || (path.size() >= sizeof(addr.sun_path)))
+    {
+        return -1;
+    }
+
+    strcpy(addr.sun_path, path.c_str());
+    if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static std::string default_socket_path()
+{
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    return std::string(runtime_dir ? runtime_dir : "/tmp") + "/wf-ipc-replay-" +
+           std::to_string(getpid()) + ".socket";
+}
+
+static void write_entry(std::ostream& out, double time_ms, bool from_client, const wf::json_t& message)
+{
+    wf::json_t entry;
+    entry["time-ms"] = time_ms;
+    entry["from"]    = from_client ? "client" : "server";
+    entry["message"] = message;
+    out << entry.serialize() << "\n";
+}
+
+static bool load_trace(const std::string& path, std::vector<trace_entry_t>& trace)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        std::cerr << "Cannot open trace " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (int line_nr = 1; std::getline(in, line); line_nr++)
+    {
+        if (line.empty())
+        {
+            continue;
+        }
+
+        wf::json_t entry;
+        auto err = wf::json_t::parse_string(line, entry);
+        if (err.has_value())
+        {
+            std::cerr << path << ":" << line_nr << ": " << err.value() << std::endl;
+            return false;
+        }
+
+        trace.push_back({as_number(entry["time-ms"]), entry["from"].as_string() == "client",
+            entry["message"]});
+    }
+
+    return true;
+}
+
+/*
+ * Record: a proxy between one client and the real compositor socket,
+ * logging every frame in both directions.
+ */
+static int record(const std::string& trace_path, std::string socket_path)
+{
+    const char *upstream_path = getenv("WAYFIRE_SOCKET");
+    if (!upstream_path)
+    {
+        std::cerr << "WAYFIRE_SOCKET is not set" << std::endl;
+        return 1;
+    }
+
+    std::ofstream out(trace_path);
+    int listen_fd = listen_on(socket_path);
+    if (!out || (listen_fd < 0))
+    {
+        return 1;
+    }
+
+    std::cout << "Recording, start the client with WAYFIRE_SOCKET=" << socket_path << std::endl;
+    int client = accept(listen_fd, nullptr, nullptr);
+    int server = connect_to(upstream_path);
+    if ((client < 0) || (server < 0))
+    {
+        std::cerr << "Cannot connect client to " << upstream_path << std::endl;
+        return 1;
+    }
+
+    auto start = steady_clock::now();
+    size_t frames = 0;
+    pollfd fds[2];
+    fds[0].fd     = client;
+    fds[0].events = POLLIN;
+    fds[1].fd     = server;
+    fds[1].events = POLLIN;
+    while (poll(fds, 2, -1) >= 0)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            if (!fds[i].revents)
+            {
+                continue;
+            }
+
+            std::string frame;
+            if (!read_frame(fds[i].fd, frame) || !write_frame(fds[1 - i].fd, frame))
+            {
+                std::cout << "Connection closed, recorded " << frames << " messages" << std::endl;
+                unlink(socket_path.c_str());
+                return 0;
+            }
+
+            wf::json_t message;
+            if (!wf::json_t::parse_string(frame, message).has_value())
+            {
+                write_entry(out, ms_since(start), i == 0, message);
+                frames++;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Replay: answers requests with the recorded replies of the same method and
+ * sends the recorded events with their original spacing, divided by speed.
+ */
+class ReplayServer
+{
+    std::map<std::string, std::vector<wf::json_t>> replies;
+    std::map<std::string, size_t> next_reply;
+    std::vector<trace_entry_t> events;
+    std::set<std::string> watched;
+    bool watch_all = false;
+
+    double speed;
+    int client = -1;
+    size_t requests = 0;
+    size_t events_sent = 0;
+
+    void index_trace(const std::vector<trace_entry_t>& trace)
+    {
+        // Replies come in request order, like in the real protocol
+        std::deque<std::string> methods;
+        for (auto& entry : trace)
+        {
+            if (entry.from_client)
+            {
+                methods.push_back(entry.message.has_member("method") ?
+                    entry.message["method"].as_string() : "");
+            } else if (entry.message.has_member("event"))
+            {
+                events.push_back(entry);
+            } else if (!methods.empty())
+            {
+                replies[methods.front()].push_back(entry.message);
+                methods.pop_front();
+            }
+        }
+    }
+
+    bool answer(const std::string& frame)
+    {
+        wf::json_t request, reply;
+        if (wf::json_t::parse_string(frame, request).has_value())
+        {
+            std::cerr << "Bad request: " << frame << std::endl;
+            return false;
+        }
+
+        std::string method = request["method"].as_string();
+        if (method == "window-rules/events/watch")
+        {
+            watch_all = !request.has_member("events") || (request["events"].size() == 0);
+            watched.clear();
+            for (size_t i = 0; !watch_all && (i < request["events"].size()); i++)
+            {
+                watched.insert(request["events"][i].as_string());
+            }
+        }
+
+        auto& recorded = replies[method];
+        if (recorded.empty())
+        {
+            reply["result"] = "ok";
+        } else
+        {
+            reply = recorded[next_reply[method]++ % recorded.size()];
+        }
+
+        requests++;
+        return write_frame(client, reply.serialize());
+    }
+
+  public:
+    ReplayServer(const std::vector<trace_entry_t>& trace, double speed) : speed(speed)
+    {
+        index_trace(trace);
+    }
+
+    /* Serve one client until all events were sent, then linger a bit */
+    bool serve(int listen_fd, std::function<void()> events_started)
+    {
+        client = accept(listen_fd, nullptr, nullptr);
+        if (client < 0)
+        {
+            return false;
+        }
+
+        double events_start_ms = events.empty() ? 0 : events.front().time_ms;
+        bool started = false;
+        steady_clock::time_point start;
+        size_t next_event = 0;
+        double linger_until_ms = -1;
+
+        while (true)
+        {
+            int timeout = -1;
+            if (started && (next_event < events.size()))
+            {
+                double due = (events[next_event].time_ms - events_start_ms) / speed - ms_since(start);
+                timeout = (speed <= 0) ? 0 : std::max(0, (int)due);
+            } else if (linger_until_ms >= 0)
+            {
+                timeout = std::max(0, (int)(linger_until_ms - ms_since(start)));
+            }
+
+            pollfd fd;
+            fd.fd     = client;
+            fd.events = POLLIN;
+            int ready = poll(&fd, 1, timeout);
+            if ((ready < 0) && (errno != EINTR))
+            {
+                return false;
+            }
+
+            if ((ready > 0) && fd.revents)
+            {
+                std::string frame;
+                if (!read_frame(client, frame) || !answer(frame))
+                {
+                    // The client went away
+                    return true;
+                }
+
+                // Events start flowing once the client watches them
+                if (!started && (watch_all || !watched.empty()))
+                {
+                    started = true;
+                    start   = steady_clock::now();
+                    events_started();
+                }
+            }
+
+            while (started && (next_event < events.size()) &&
+                   ((speed <= 0) ||
+                    ((events[next_event].time_ms - events_start_ms) / speed <= ms_since(start))))
+            {
+                auto& event = events[next_event++].message;
+                if (watch_all || watched.count(event["event"].as_string()))
+                {
+                    if (!write_frame(client, event.serialize()))
+                    {
+                        return true;
+                    }
+
+                    events_sent++;
+                }
+            }
+
+            if (started && (next_event == events.size()))
+            {
+                if (linger_until_ms < 0)
+                {
+                    // Give the client time to process the last events
+                    linger_until_ms = ms_since(start) + 500;
+                } else if (ms_since(start) >= linger_until_ms)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+
+    void report(std::ostream& out)
+    {
+        out << "requests answered: " << requests << std::endl;
+        out << "events sent: " << events_sent << " of " << events.size() << std::endl;
+    }
+};
+
+/*
+ * The client's allocations are counted by a preloaded library, which writes
+ * them to a file shared with the tool.
+ */
+class AllocCounter
+{
+    std::string library;
+    std::string path;
+    wf_ipc_replay_alloc_stats_t *stats = nullptr;
+
+  public:
+    AllocCounter(const std::string& library) : library(library)
+    {
+        if (library.empty() || (access(library.c_str(), R_OK) < 0))
+        {
+            return;
+        }
+
+        path = default_socket_path() + ".allocs";
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if ((fd < 0) || (ftruncate(fd, sizeof(*stats)) < 0))
+        {
+            std::cerr << "Cannot create " << path << ", allocations are not counted" << std::endl;
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+
+            return;
+        }
+
+        void *data = mmap(nullptr, sizeof(*stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data != MAP_FAILED)
+        {
+            stats = (wf_ipc_replay_alloc_stats_t*)data;
+        }
+    }
+
+    ~AllocCounter()
+    {
+        if (stats)
+        {
+            munmap(stats, sizeof(*stats));
+            unlink(path.c_str());
+        }
+    }
+
+    /* In the child, before running the client */
+    void preload()
+    {
+        if (!stats)
+        {
+            return;
+        }
+
+        const char *preloaded = getenv("LD_PRELOAD");
+        std::string value     = library + (preloaded ? std::string(" ") + preloaded : "");
+        setenv("LD_PRELOAD", value.c_str(), 1);
+        setenv(WF_IPC_REPLAY_ALLOC_FILE_ENV, path.c_str(), 1);
+    }
+
+    /* Once the events start, allocations during the client's startup do not count */
+    void reset()
+    {
+        if (stats)
+        {
+            __atomic_store_n(&stats->allocations, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&stats->frees, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&stats->bytes, 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    void report(std::ostream& out)
+    {
+        if (!stats)
+        {
+            return;
+        }
+
+        // Counted since the first event, the client's startup is left out
+        out << "client allocations: " << __atomic_load_n(&stats->allocations, __ATOMIC_RELAXED) << std::endl;
+        out << "client frees: " << __atomic_load_n(&stats->frees, __ATOMIC_RELAXED) << std::endl;
+        out << "client allocated bytes: " << __atomic_load_n(&stats->bytes, __ATOMIC_RELAXED) << std::endl;
+    }
+};
+
+static int replay(const std::string& trace_path, const std::string& socket_path, double speed,
+    const std::string& alloc_counter, char **command)
+{
+    std::vector<trace_entry_t> trace;
+    int listen_fd = listen_on(socket_path);
+    if (!load_trace(trace_path, trace) || (listen_fd < 0))
+    {
+        return 1;
+    }
+
+    AllocCounter allocs(alloc_counter);
+    pid_t child = -1;
+    if (command && command[0])
+    {
+        child = fork();
+        if (child == 0)
+        {
+            setenv("WAYFIRE_SOCKET", socket_path.c_str(), 1);
+            allocs.preload();
+            execvp(command[0], command);
+            std::cerr << "Cannot run " << command[0] << ": " << strerror(errno) << std::endl;
+            _exit(127);
+        }
+    } else
+    {
+        std::cout << "Replaying, start the client with WAYFIRE_SOCKET=" << socket_path << std::endl;
+    }
+
+    ReplayServer server(trace, speed);
+    auto start = steady_clock::now();
+    bool ok    = server.serve(listen_fd, [&] () { allocs.reset(); });
+    double wall_ms = ms_since(start);
+    unlink(socket_path.c_str());
+
+    server.report(std::cout);
+    std::cout << "wall time: " << wall_ms << " ms" << std::endl;
+    if (child > 0)
+    {
+        // The client does not exit on its own, its usage is what we want
+        kill(child, SIGTERM);
+        int status;
+        rusage usage;
+        if (wait4(child, &status, 0, &usage) == child)
+        {
+            auto to_ms = [] (const timeval& tv) { return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0; };
+            std::cout << "client user cpu: " << to_ms(usage.ru_utime) << " ms" << std::endl;
+            std::cout << "client system cpu: " << to_ms(usage.ru_stime) << " ms" << std::endl;
+            std::cout << "client max rss: " << usage.ru_maxrss << " KiB" << std::endl;
+            std::cout << "client minor page faults: " << usage.ru_minflt << std::endl;
+        }
+
+        allocs.report(std::cout);
+    }
+
+    return ok ? 0 : 1;
+}
+
+/*
+ * Synthetic scenarios, for benchmarks which do not depend on a recording.
+ */
+static constexpr int GRID_SIZE = 3;
+static constexpr int VIEW_COUNT = 20;
+
+static wf::json_t make_geometry(int x, int y, int width, int height)
+{
+    wf::json_t geometry;
+    geometry["x"]     = x;
+    geometry["y"]     = y;
+    geometry["width"] = width;
+    geometry["height"] = height;
+    return geometry;
+}
+
+static wf::json_t make_view(int id, int x, int y)
+{
+    wf::json_t view;
+    view["id"]     = id;
+    view["type"]   = "toplevel";
+    view["app-id"] = "app-" + std::to_string(id);
+    view["title"]  = "Window " + std::to_string(id);
+    view["output-id"]   = 1;
+    view["output-name"] = "WL-1";
+    view["wset-index"]  = 1;
+    view["minimized"]   = false;
+    view["activated"]   = (id == 1);
+    view["geometry"]    = make_geometry(x, y, 800, 600);
+    return view;
+}
+
+static wf::json_t make_workspace(int x, int y)
+{
+    wf::json_t workspace;
+    workspace["x"] = x;
+    workspace["y"] = y;
+    workspace["grid_width"]  = GRID_SIZE;
+    workspace["grid_height"] = GRID_SIZE;
+    return workspace;
+}
+
+static wf::json_t make_keyboard_state(int layout)
+{
+    wf::json_t keyboard;
+    keyboard["layout-index"]     = layout;
+    keyboard["possible-layouts"] = wf::json_t::array();
+    for (auto name : {"English (US)", "German", "French"})
+    {
+        keyboard["possible-layouts"].append(name);
+    }
+
+    return keyboard;
+}
+
+static std::map<std::string, wf::json_t> make_replies()
+{
+    std::map<std::string, wf::json_t> replies;
+
+    wf::json_t output;
+    output["id"]   = 1;
+    output["name"] = "WL-1";
+    output["wset-index"] = 1;
+    output["geometry"]   = make_geometry(0, 0, 1920, 1080);
+    output["workarea"]   = make_geometry(0, 0, 1920, 1080);
+    output["workspace"]  = make_workspace(0, 0);
+    replies["window-rules/list-outputs"] = wf::json_t::array();
+    replies["window-rules/list-outputs"].append(output);
+    replies["window-rules/output-info"] = output;
+
+    wf::json_t wset;
+    wset["index"]     = 1;
+    wset["name"]      = "wset-1";
+    wset["output-id"] = 1;
+    wset["output-name"] = "WL-1";
+    wset["workspace"]   = make_workspace(0, 0);
+    replies["window-rules/list-wsets"] = wf::json_t::array();
+    replies["window-rules/list-wsets"].append(wset);
+
+    // Spread over all workspaces of the grid
+    replies["window-rules/list-views"] = wf::json_t::array();
+    for (int i = 1; i <= VIEW_COUNT; i++)
+    {
+        int ws = i % (GRID_SIZE * GRID_SIZE);
+        replies["window-rules/list-views"].append(make_view(i, 1920 * (ws % GRID_SIZE) + 10 * i,
+            1080 * (ws / GRID_SIZE) + 10 * i));
+    }
+
+    replies["wayfire/get-keyboard-state"] = make_keyboard_state(0);
+    return replies;
+}
+
+static wf::json_t make_event(const std::string& scenario, int i)
+{
+    wf::json_t event;
+    if (scenario == "workspaces")
+    {
+        event["event"]  = "wset-workspace-changed";
+        event["output"] = 1;
+        event["wset"]   = 1;
+        event["new-workspace"] = make_workspace(i % GRID_SIZE, (i / GRID_SIZE) % GRID_SIZE);
+    } else if (scenario == "drag")
+    {
+        // A window dragged in circles over the first workspace
+        event["event"] = "view-geometry-changed";
+        event["view"]  = make_view(1, 500 + (i % 200), 300 + ((i / 2) % 100));
+    } else if (scenario == "layouts")
+    {
+        event["event"] = "keyboard-modifier-state-changed";
+        event["state"] = make_keyboard_state(i % 3);
+    }
+
+    return event;
+}
+
+static int generate(const std::string& scenario, int count, double interval_ms, const std::string& path)
+{
+    static const std::set<std::string> scenarios = {"workspaces", "drag", "layouts", "mixed"};
+    if (!scenarios.count(scenario))
+    {
+        std::cerr << "Unknown scenario " << scenario << std::endl;
+        return 1;
+    }
+
+    std::ofstream out(path);
+    if (!out)
+    {
+        std::cerr << "Cannot write " << path << std::endl;
+        return 1;
+    }
+
+    for (auto& [method, reply] : make_replies())
+    {
+        wf::json_t request;
+        request["method"] = method;
+        write_entry(out, 0, true, request);
+        write_entry(out, 0, false, reply);
+    }
+
+    static const char *mixed[] = {"drag", "drag", "drag", "workspaces", "layouts"};
+    for (int i = 0; i < count; i++)
+    {
+        auto kind = (scenario == "mixed") ? mixed[i % 5] : scenario;
+        write_entry(out, (i + 1) * interval_ms, false, make_event(kind, i));
+    }
+
+    return 0;
+}
+
+#ifndef WF_IPC_REPLAY_ALLOC_COUNTER
+    #define WF_IPC_REPLAY_ALLOC_COUNTER ""
+#endif
+
+static void usage()
+{
+    std::cerr <<
+        "Usage:\n"
+        "  wf-ipc-replay record <trace> [socket]\n"
+        "      Proxy a client to $WAYFIRE_SOCKET and record the traffic\n"
+        "  wf-ipc-replay replay <trace> [--speed <factor>] [--socket <path>] [--alloc-counter <library>]\n"
+        "          [-- <command>...]\n"
+        "      Serve the trace, speed 0 sends the events as fast as possible.\n"
+        "      With a command, run it against the server and report its CPU usage\n"
+        "      and, with the allocation counter library, its heap allocations.\n"
+        "  wf-ipc-replay generate <workspaces|drag|layouts|mixed> <count> <trace> [interval-ms]\n"
+        "      Write a synthetic trace with count events\n"
+        "  wf-ipc-replay benchmark <workspaces|drag|layouts|mixed> <count> [replay options] -- <command>...\n"
+        "      Generate a trace and replay it against the command\n";
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        usage();
+        return 1;
+    }
+
+    std::string mode = argv[1];
+    if (mode == "record")
+    {
+        return record(argv[2], (argc > 3) ? argv[3] : default_socket_path());
+    }
+
+    if ((mode == "replay") || ((mode == "benchmark") && (argc >= 4)))
+    {
+        double speed = (mode == "benchmark") ? 0 : 1;
+        std::string socket_path   = default_socket_path();
+        std::string alloc_counter = WF_IPC_REPLAY_ALLOC_COUNTER;
+        char **command = nullptr;
+        for (int i = (mode == "benchmark") ? 4 : 3; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if ((arg == "--speed") && (i + 1 < argc))
+            {
+                speed = atof(argv[++i]);
+            } else if ((arg == "--socket") && (i + 1 < argc))
+            {
+                socket_path = argv[++i];
+            } else if ((arg == "--alloc-counter") && (i + 1 < argc))
+            {
+                alloc_counter = argv[++i];
+            } else if (arg == "--")
+            {
+                command = argv + i + 1;
+                break;
+            } else
+            {
+                usage();
+                return 1;
+            }
+        }
+
+        if (mode == "replay")
+        {
+            return replay(argv[2], socket_path, speed, alloc_counter, command);
+        }
+
+        std::string trace_path = socket_path + ".trace";
+        int result = generate(argv[2], atoi(argv[3]), 1.0, trace_path);
+        if (result == 0)
+        {
+            result = replay(trace_path, socket_path, speed, alloc_counter, command);
+        }
+
+        unlink(trace_path.c_str());
+        return result;
+    }
+
+    if ((mode == "generate") && (argc >= 5))
+    {
+        return generate(argv[2], atoi(argv[3]), (argc > 5) ? atof(argv[5]) : 1.0, argv[4]);
+    }
+
+    usage();
+    return 1;
+}
@@ -5,6 +5,7 @@
 #include <gtkmm/application.h>
 #include <gdk/wayland/gdkwayland.h>
 #include <gtk4-layer-shell.h>
+#include <glib-unix.h>
 
 #include <iostream>
 #include <memory>
@@ -496,6 +497,7 @@ class WayfirePanelApp::impl
   public:
     std::map<WayfireOutput*, std::unique_ptr<WayfirePanel>> panels;
     WfOption<std::string> *panel_outputs = NULL;
+    WfOption<bool> ipc_reader_thread{"panel/ipc_reader_thread"};
 };
 
 void WayfirePanelApp::on_config_reload()
@@ -573,6 +575,12 @@ void WayfirePanelApp::on_activate()
         ipc_server = WayfireIPC::get_instance();
     }
 
+    ipc_server->set_reader_thread(priv->ipc_reader_thread);
+    priv->ipc_reader_thread.set_callback([=] ()
+    {
+        ipc_server->set_reader_thread(priv->ipc_reader_thread);
+    });
+
     for (auto& p : priv->panels)
     {
         p.second->handle_config_reload();
@@ -679,9 +687,26 @@ void WayfirePanelApp::create(int argc, char **argv)
 
     instance = std::unique_ptr<WayfireShellApp>(new WayfirePanelApp{});
     instance->init_app();
+    g_unix_signal_add(SIGUSR1, sigusr1_handler, (void*)instance.get());
     instance->run(argc, argv);
 }
 
+gboolean WayfirePanelApp::sigusr1_handler(void *instance)
+{
+    auto app = (WayfirePanelApp*)instance;
+    if (app->ipc_server)
+    {
+        std::cout << app->ipc_server->dump_stats() << std::endl;
+    }
+
+    if (auto thumbnails = WayfireWorkspaceThumbnails::find_instance())
+    {
+        std::cout << thumbnails->dump_stats() << std::endl;
+    }
+
+    return TRUE;
+}
+
 std::string WayfirePanelApp::get_application_name()
 {
     return "org.wayfire.panel";
@@ -54,6 +54,8 @@ class WayfirePanelApp : public WayfireShellApp
 
   private:
     WayfirePanelApp();
+    /* Prints the IPC statistics to stdout */
+    static gboolean sigusr1_handler(void *instance);
 
     class impl;
     std::unique_ptr<impl> priv;
@@ -14,6 +14,7 @@
 
 #include "language.hpp"
 #include "wf-ipc.hpp"
+#include "wf-ipc-state.hpp"
 #include "panel.hpp"
 
 void WayfireLanguage::init(Gtk::Box *container)
@@ -38,36 +39,38 @@ void WayfireLanguage::init(Gtk::Box *container)
 
     container->append(label);
 
-    ipc_client->subscribe(this, {"keyboard-modifier-state-changed"});
-    ipc_client->send("{\"method\":\"wayfire/get-keyboard-state\"}", [=] (wf::json_t data)
+    ipc_state = WayfireIPCState::get_instance();
+    keyboard_sig = ipc_state->signal_keyboard_changed().connect(
+        sigc::mem_fun(*this, &WayfireLanguage::on_keyboard_changed));
+    reset_sig = ipc_state->signal_reset().connect([this] ()
     {
-        if (data.serialize().find(
-            "error") != std::string::npos)
+        // Also emitted when other parts of the state are loaded
+        if (!ipc_state->is_ready(IPCStateGroup::KEYBOARD))
         {
-            std::cerr << "Error getting keyboard state for language widget. Is wayfire ipc-rules plugin enabled?" << std::endl;
             return;
         }
 
-        set_available(data["possible-layouts"]);
-        set_current(data["layout-index"]);
+        available_layouts.clear();
+        on_keyboard_changed(ipc_state->get_keyboard());
     });
+
+    keyboard_watch = ipc_state->watch(IPCStateGroup::KEYBOARD);
+    if (ipc_state->is_ready(IPCStateGroup::KEYBOARD))
+    {
+        on_keyboard_changed(ipc_state->get_keyboard());
+    }
 }
 
-void WayfireLanguage::on_event(wf::json_t data)
+void WayfireLanguage::on_keyboard_changed(const IPCKeyboardState& state)
 {
-    if (data["event"].as_string() == "keyboard-modifier-state-changed")
+    if (available_layouts.size() == 0)
     {
-        if (available_layouts.size() == 0)
-        {
-            set_available(data["state"]["possible-layouts"]);
-        }
+        set_available(state.layouts);
+    }
 
-        auto state_layout = data["state"]["layout-index"].as_uint();
-        if (state_layout != current_layout)
-        {
-            current_layout = state_layout;
-            set_current(state_layout);
-        }
+    if ((uint32_t)state.layout_index != current_layout)
+    {
+        set_current(state.layout_index);
     }
 }
 
@@ -88,17 +91,16 @@ void WayfireLanguage::set_current(uint32_t index)
     update_label();
 }
 
-void WayfireLanguage::set_available(wf::json_t layouts)
+void WayfireLanguage::set_available(const std::vector<std::string>& layouts)
 {
     std::vector<Layout> layouts_available;
     std::map<std::string, uint32_t> names;
 
     for (size_t i = 0; i < layouts.size(); i++)
     {
-        auto elem = layouts[i];
-        names[elem] = i;
+        names[layouts[i]] = i;
         layouts_available.push_back(Layout{
-            .Name = (std::string)elem,
+            .Name = layouts[i],
             .ID   = "",
         });
     }
@@ -132,7 +134,7 @@ void WayfireLanguage::next_layout()
     message["method"] = "wayfire/set-keyboard-state";
     message["data"]   = wf::json_t();
     message["data"]["layout-index"] = next;
-    ipc_client->send(message.serialize());
+    ipc_client->send_interactive(message.serialize());
 }
 
 WayfireLanguage::WayfireLanguage()
@@ -140,10 +142,8 @@ WayfireLanguage::WayfireLanguage()
 
 WayfireLanguage::~WayfireLanguage()
 {
-    if (ipc_client)
-    {
-        ipc_client->unsubscribe(this);
-    }
-
+    keyboard_sig.disconnect();
+    reset_sig.disconnect();
     btn_sig.disconnect();
+    keyboard_watch.reset();
 }
@@ -11,6 +11,7 @@
 
 #include "../widget.hpp"
 #include "wf-ipc.hpp"
+#include "wf-ipc-state.hpp"
 
 struct Layout
 {
@@ -18,20 +19,22 @@ struct Layout
     std::string ID;
 };
 
-class WayfireLanguage : public WayfireWidget, public IIPCSubscriber
+class WayfireLanguage : public WayfireWidget
 {
     Gtk::Label label;
-    sigc::connection btn_sig;
+    sigc::connection btn_sig, keyboard_sig, reset_sig;
     std::shared_ptr<IPCClient> ipc_client;
-    uint32_t current_layout;
+    std::shared_ptr<WayfireIPCState> ipc_state;
+    std::unique_ptr<IPCStateWatch> keyboard_watch;
+    uint32_t current_layout = 0;
     std::vector<Layout> available_layouts;
 
   public:
     void init(Gtk::Box *container);
-    void on_event(wf::json_t data) override;
+    void on_keyboard_changed(const IPCKeyboardState& state);
     bool update_label();
     void set_current(uint32_t index);
-    void set_available(wf::json_t layouts);
+    void set_available(const std::vector<std::string>& layouts);
     void next_layout();
     WayfireLanguage();
     ~WayfireLanguage();
@@ -0,0 +1,922 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <drm_fourcc.h>
+#include <gdk/wayland/gdkwayland.h>
+#include <wayfire/util/log.hpp>
+
+#include "capture.hpp"
+
+/* Toplevel Callbacks */
+
+static void toplevel_handle_closed(void *data,
+    struct ext_foreign_toplevel_handle_v1 *handle)
+{
+    ToplevelCaptureContext *context = (ToplevelCaptureContext*)data;
+    context->toplevel_closed.emit(handle);
+    ext_foreign_toplevel_handle_v1_destroy(handle);
+    context->toplevels.erase(handle);
+}
+
+static void toplevel_handle_done(void *data,
+    struct ext_foreign_toplevel_handle_v1 *handle)
+{
+    ToplevelCaptureContext *context = (ToplevelCaptureContext*)data;
+    context->toplevel_done.emit(handle);
+}
+
+static void toplevel_handle_title(void *data,
+    struct ext_foreign_toplevel_handle_v1 *handle,
+    const char *title)
+{
+    ToplevelCaptureContext *context = (ToplevelCaptureContext*)data;
+    context->toplevels[handle]->title = title;
+}
+
+static void toplevel_handle_app_id(void *data,
+    struct ext_foreign_toplevel_handle_v1 *handle,
+    const char *app_id)
+{
+    ToplevelCaptureContext *context = (ToplevelCaptureContext*)data;
+    context->toplevels[handle]->app_id = app_id;
+}
+
+static void toplevel_handle_identifier(void *data,
+    struct ext_foreign_toplevel_handle_v1 *handle,
+    const char *identifier)
+{
+    ToplevelCaptureContext *context = (ToplevelCaptureContext*)data;
+    context->toplevels[handle]->identifier = identifier;
+}
+
+static const ext_foreign_toplevel_handle_v1_listener toplevels_listener =
+{
+    .closed = toplevel_handle_closed,
+    .done   = toplevel_handle_done,
+    .title  = toplevel_handle_title,
+    .app_id = toplevel_handle_app_id,
+    .identifier = toplevel_handle_identifier,
+};
+
+/* Static callbacks for toplevel list object */
+static void handle_toplevel(void *data,
+    struct ext_foreign_toplevel_list_v1 *list,
+    struct ext_foreign_toplevel_handle_v1 *handle)
+{
+    ToplevelCaptureContext *context = (ToplevelCaptureContext*)data;
+    context->toplevels[handle] = std::make_unique<WayfireListToplevel>();
+    ext_foreign_toplevel_handle_v1_add_listener(handle, &toplevels_listener, context);
+}
+
+static void handle_finished(void *data,
+    struct ext_foreign_toplevel_list_v1 *list)
+{
+    ToplevelCaptureContext *context = (ToplevelCaptureContext*)data;
+    ext_foreign_toplevel_list_v1_destroy(list);
+    context->foreign_toplevel_list = NULL;
+}
+
+static const ext_foreign_toplevel_list_v1_listener toplevel_list_v1_impl = {
+    .toplevel = handle_toplevel,
+    .finished = handle_finished,
+};
+
+static void dmabuf_feedback_done(void *data, struct zwp_linux_dmabuf_feedback_v1 *feedback)
+{
+    ToplevelCaptureContext *context = (ToplevelCaptureContext*)data;
+
+    zwp_linux_dmabuf_feedback_v1_destroy(feedback);
+    context->feedback = nullptr;
+}
+
+static void dmabuf_feedback_format_table(void*, struct zwp_linux_dmabuf_feedback_v1*,
+    int32_t fd, uint32_t)
+{
+    close(fd);
+}
+
+static void dmabuf_feedback_main_device(void *data, struct zwp_linux_dmabuf_feedback_v1*,
+    struct wl_array *device)
+{
+    ToplevelCaptureContext *context = (ToplevelCaptureContext*)data;
+
+    int drm_fd;
+    dev_t dev_id;
+    std::string drm_device_name;
+    memcpy(&dev_id, device->data, device->size);
+
+    drmDevice *dev = NULL;
+    if (drmGetDeviceFromDevId(dev_id, 0, &dev) != 0)
+    {
+        perror("Failed to get DRM device from dev id");
+        return;
+    }
+
+    if (dev->available_nodes & (1 << DRM_NODE_RENDER))
+    {
+        drm_device_name = dev->nodes[DRM_NODE_RENDER];
+    } else if (dev->available_nodes & (1 << DRM_NODE_PRIMARY))
+    {
+        drm_device_name = dev->nodes[DRM_NODE_PRIMARY];
+    }
+
+    drm_fd = open(drm_device_name.c_str(), O_RDWR);
+    if (drm_fd < 0)
+    {
+        perror("Failed to open drm device");
+        return;
+    }
+
+    context->dmabuf_device = gbm_create_device(drm_fd);
+    if (context->dmabuf_device == NULL)
+    {
+        close(drm_fd);
+        perror("Failed to create gbm device");
+        return;
+    }
+
+    std::cout << "Live previews using drm device node: \"" << drm_device_name << "\"" << std::endl;
+
+    drmFreeDevice(&dev);
+    close(drm_fd);
+}
+
+static void dmabuf_feedback_tranche_done(void*, struct zwp_linux_dmabuf_feedback_v1*)
+{}
+
+static void dmabuf_feedback_tranche_target_device(void*, struct zwp_linux_dmabuf_feedback_v1*,
+    struct wl_array*)
+{}
+
+static void dmabuf_feedback_tranche_formats(void*, struct zwp_linux_dmabuf_feedback_v1*,
+    struct wl_array*)
+{}
+
+static void dmabuf_feedback_tranche_flags(void*, struct zwp_linux_dmabuf_feedback_v1*,
+    uint32_t)
+{}
+
+static const struct zwp_linux_dmabuf_feedback_v1_listener dmabuf_feedback_listener = {
+    .done = dmabuf_feedback_done,
+    .format_table = dmabuf_feedback_format_table,
+    .main_device  = dmabuf_feedback_main_device,
+    .tranche_done = dmabuf_feedback_tranche_done,
+    .tranche_target_device = dmabuf_feedback_tranche_target_device,
+    .tranche_formats = dmabuf_feedback_tranche_formats,
+    .tranche_flags   = dmabuf_feedback_tranche_flags,
+};
+
+static void registry_add_object(void *data, wl_registry *registry, uint32_t name,
+    const char *interface, uint32_t version)
+{
+    ToplevelCaptureContext *context = (ToplevelCaptureContext*)data;
+
+    if (strcmp(interface, ext_foreign_toplevel_list_v1_interface.name) == 0)
+    {
+        auto foreign_toplevel_list = (ext_foreign_toplevel_list_v1*)
+            wl_registry_bind(registry, name,
+            &ext_foreign_toplevel_list_v1_interface,
+            version);
+        context->foreign_toplevel_list = foreign_toplevel_list;
+        ext_foreign_toplevel_list_v1_add_listener(foreign_toplevel_list,
+            &toplevel_list_v1_impl, context);
+    } else if (strcmp(interface, ext_image_copy_capture_manager_v1_interface.name) == 0)
+    {
+        auto copy_capture_manager = (ext_image_copy_capture_manager_v1*)wl_registry_bind(registry, name,
+            &ext_image_copy_capture_manager_v1_interface, version);
+        context->copy_capture_manager = copy_capture_manager;
+    } else if (strcmp(interface, ext_foreign_toplevel_image_capture_source_manager_v1_interface.name) == 0)
+    {
+        auto toplevel_capture_manager =
+            (ext_foreign_toplevel_image_capture_source_manager_v1*)wl_registry_bind(registry, name,
+                &ext_foreign_toplevel_image_capture_source_manager_v1_interface, version);
+        context->toplevel_capture_manager = toplevel_capture_manager;
+    } else if (strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0)
+    {
+        context->dmabuf = (zwp_linux_dmabuf_v1*)wl_registry_bind(registry, name,
+            &zwp_linux_dmabuf_v1_interface, version);
+        if (context->dmabuf)
+        {
+            context->feedback = zwp_linux_dmabuf_v1_get_default_feedback(context->dmabuf);
+            zwp_linux_dmabuf_feedback_v1_add_listener(context->feedback, &dmabuf_feedback_listener,
+                context);
+        }
+    }
+}
+
+static void registry_remove_object(void *data, struct wl_registry *registry, uint32_t name)
+{}
+
+static struct wl_registry_listener registry_listener =
+{
+    &registry_add_object,
+    &registry_remove_object
+};
+
+ToplevelCaptureContext::ToplevelCaptureContext()
+{
+    auto display = gdk_wayland_display_get_wl_display(gdk_display_get_default());
+    registry = wl_display_get_registry(display);
+    wl_registry_add_listener(registry, &registry_listener, this);
+    // The toplevels and the dmabuf device arrive later
+    wl_display_roundtrip(display);
+
+    if (!this->foreign_toplevel_list)
+    {
+        std::cerr << "Compositor doesn't support" <<
+            " ext-foreign-toplevel-list-v1." << std::endl;
+        std::cerr << "Live window previews cannot be enabled." << std::endl;
+    }
+
+    if (!this->toplevel_capture_manager || !this->copy_capture_manager)
+    {
+        std::cerr << "Compositor doesn't support" <<
+            " ext-foreign-toplevel-image-copy-capture-v1." << std::endl;
+        std::cerr << "Live window previews cannot be enabled." << std::endl;
+    }
+}
+
+ToplevelCaptureContext::~ToplevelCaptureContext()
+{
+    for (auto & toplevel : toplevels)
+    {
+        ext_foreign_toplevel_handle_v1_destroy(toplevel.first);
+    }
+
+    toplevels.clear();
+
+    wl_registry_destroy(registry);
+
+    if (this->foreign_toplevel_list)
+    {
+        ext_foreign_toplevel_list_v1_stop(this->foreign_toplevel_list);
+        ext_foreign_toplevel_list_v1_destroy(this->foreign_toplevel_list);
+    }
+
+    if (this->copy_capture_manager)
+    {
+        ext_image_copy_capture_manager_v1_destroy(this->copy_capture_manager);
+    }
+
+    if (this->toplevel_capture_manager)
+    {
+        ext_foreign_toplevel_image_capture_source_manager_v1_destroy(this->toplevel_capture_manager);
+    }
+
+    if (this->feedback)
+    {
+        zwp_linux_dmabuf_feedback_v1_destroy(this->feedback);
+    }
+
+    if (this->dmabuf)
+    {
+        zwp_linux_dmabuf_v1_destroy(this->dmabuf);
+    }
+
+    if (this->dmabuf_device)
+    {
+        gbm_device_destroy(this->dmabuf_device);
+    }
+}
+
+std::shared_ptr<ToplevelCaptureContext> ToplevelCaptureContext::get_instance()
+{
+    auto context = instance.lock();
+    if (!context)
+    {
+        context  = std::make_shared<ToplevelCaptureContext>();
+        instance = context;
+    }
+
+    return context;
+}
+
+bool ToplevelCaptureContext::is_available() const
+{
+    return foreign_toplevel_list && copy_capture_manager && toplevel_capture_manager && dmabuf;
+}
+
+uint64_t ToplevelCaptureContext::get_view_id_from_full_app_id(const std::string& app_id)
+{
+    const std::string sub_str = "wf-ipc-";
+    size_t pos = app_id.find(sub_str);
+
+    if (pos != std::string::npos)
+    {
+        size_t suffix_start_index = pos + sub_str.length();
+        if (suffix_start_index < app_id.length())
+        {
+            try {
+                uint64_t view_id = std::stoi(app_id.substr(suffix_start_index, std::string::npos));
+                return view_id;
+            } catch (...)
+            {
+                return 0;
+            }
+        } else
+        {
+            return 0;
+        }
+    } else
+    {
+        return 0;
+    }
+}
+
+ext_foreign_toplevel_handle_v1*ToplevelCaptureContext::find_toplevel(uint64_t view_id) const
+{
+    for (auto & toplevel : toplevels)
+    {
+        if (toplevel.second && (get_view_id_from_full_app_id(toplevel.second->app_id) == view_id))
+        {
+            return toplevel.first;
+        }
+    }
+
+    return NULL;
+}
+
+/* Session Callbacks */
+
+static void session_handle_buffer_size(void *data,
+    struct ext_image_copy_capture_session_v1*,
+    uint32_t width, uint32_t height)
+{
+    ToplevelCapture *capture = (ToplevelCapture*)data;
+    capture->current_buffer_width  = width;
+    capture->current_buffer_height = height;
+}
+
+static void session_handle_shm_format(void *data,
+    struct ext_image_copy_capture_session_v1*,
+    uint32_t format)
+{}
+
+static void session_handle_dmabuf_device(void*,
+    struct ext_image_copy_capture_session_v1*,
+    struct wl_array*)
+{}
+
+static void session_handle_dmabuf_format(void *data,
+    struct ext_image_copy_capture_session_v1*,
+    uint32_t format,
+    struct wl_array*)
+{
+    ToplevelCapture *capture = (ToplevelCapture*)data;
+    capture->current_buffer_format = format;
+}
+
+static void session_handle_done(void *data,
+    struct ext_image_copy_capture_session_v1*)
+{
+    // The buffer constraints are known, the first frame can be requested
+    ToplevelCapture *capture = (ToplevelCapture*)data;
+    capture->schedule_next_frame();
+}
+
+static void session_handle_stopped(void *data,
+    struct ext_image_copy_capture_session_v1 *session)
+{
+    ToplevelCapture *capture = (ToplevelCapture*)data;
+    capture->stop();
+}
+
+static const struct ext_image_copy_capture_session_v1_listener recording_session_listener = {
+    .buffer_size   = session_handle_buffer_size,
+    .shm_format    = session_handle_shm_format,
+    .dmabuf_device = session_handle_dmabuf_device,
+    .dmabuf_format = session_handle_dmabuf_format,
+    .done    = session_handle_done,
+    .stopped = session_handle_stopped,
+};
+
+/* Copy Capture Callbacks */
+
+static void frame_handle_transform(void*,
+    struct ext_image_copy_capture_frame_v1*,
+    uint32_t)
+{}
+
+static void frame_handle_damage(void *data,
+    struct ext_image_copy_capture_frame_v1*,
+    int32_t x, int32_t y, int32_t width, int32_t height)
+{
+    ToplevelCapture *capture = (ToplevelCapture*)data;
+    capture->frame_damaged = true;
+    capture->frame_damage.add(x, y, width, height);
+}
+
+static void frame_handle_presentation_time(void*,
+    struct ext_image_copy_capture_frame_v1*,
+    uint32_t, uint32_t, uint32_t)
+{}
+
+/* Copy the buffer to memory, scaled down to max_width */
+static Glib::RefPtr<Gdk::Texture> capture_build_memory_texture(ToplevelCaptureBuffer *buffer,
+    uint32_t max_width)
+{
+    // The undefined X byte would be interpolated into the edges when scaling
+    bool xrgb = (buffer->format == DRM_FORMAT_XRGB8888);
+    uint32_t stride  = 0;
+    void *map_data   = NULL;
+    void *pixel_data = gbm_bo_map(buffer->bo, 0, 0, buffer->width, buffer->height,
+        xrgb ? GBM_BO_TRANSFER_READ_WRITE : GBM_BO_TRANSFER_READ, &stride, &map_data);
+    if (!pixel_data)
+    {
+        perror("failed to map bo");
+        return {};
+    }
+
+    if (xrgb)
+    {
+        for (uint32_t y = 0; y < buffer->height; y++)
+        {
+            for (uint32_t x = 0; x < buffer->width; x++)
+            {
+                ((guint8*)pixel_data)[y * stride + x * 4 + 3] = 0xff;
+            }
+        }
+    }
+
+    /* Scale */
+    auto pixbuf = Gdk::Pixbuf::create_from_data(
+        (const guint8*)pixel_data,
+        Gdk::Colorspace::RGB,
+        true,
+        8,
+        buffer->width,
+        buffer->height,
+        stride);
+
+    // Only as many pixels as are shown on screen are kept
+    uint32_t w = std::clamp<uint32_t>(max_width, 1, buffer->width);
+    uint32_t h = std::max<uint32_t>(1, buffer->height * ((float)w / buffer->width));
+
+    auto scaled_pixbuf = pixbuf->scale_simple(
+        w, h, Gdk::InterpType::BILINEAR);
+
+    gbm_bo_unmap(buffer->bo, map_data);
+
+    w = scaled_pixbuf->get_width();
+    h = scaled_pixbuf->get_height();
+    uint32_t s = scaled_pixbuf->get_rowstride();
+
+    /* Swap red and blue channels */
+    size_t size = s * h;
+    pixel_data = scaled_pixbuf->get_pixels();
+    std::shared_ptr<Glib::Bytes> bytes = Glib::Bytes::create((unsigned char*)pixel_data, size);
+
+    if (!bytes)
+    {
+        return {};
+    }
+
+    auto builder = Gdk::MemoryTextureBuilder::create();
+    builder->set_bytes(bytes);
+    builder->set_width(w);
+    builder->set_height(h);
+    builder->set_stride(s);
+    builder->set_format(Gdk::MemoryFormat::B8G8R8A8);
+
+    return builder->build();
+}
+
+#if GTK_CHECK_VERSION(4, 14, 0)
+static void dmabuf_texture_released(gpointer data)
+{
+    // May be called from a render thread, the buffer is handed back on the main loop
+    auto buffer = (std::shared_ptr<ToplevelCaptureBuffer>*)data;
+    Glib::MainContext::get_default()->invoke([buffer] ()
+    {
+        (*buffer)->in_use = false;
+        if ((*buffer)->owner)
+        {
+            (*buffer)->owner->schedule_next_frame();
+        }
+
+        delete buffer;
+        return false;
+    });
+}
+
+/* Show the buffer as it is, GTK scales it when drawing. Null if GTK cannot import it. */
+static Glib::RefPtr<Gdk::Texture> capture_build_dmabuf_texture(
+    const std::shared_ptr<ToplevelCaptureBuffer>& buffer)
+{
+    auto builder = gdk_dmabuf_texture_builder_new();
+    gdk_dmabuf_texture_builder_set_display(builder, gdk_display_get_default());
+    gdk_dmabuf_texture_builder_set_width(builder, buffer->width);
+    gdk_dmabuf_texture_builder_set_height(builder, buffer->height);
+    gdk_dmabuf_texture_builder_set_fourcc(builder, buffer->format);
+    gdk_dmabuf_texture_builder_set_modifier(builder, gbm_bo_get_modifier(buffer->bo));
+    gdk_dmabuf_texture_builder_set_n_planes(builder, 1);
+    gdk_dmabuf_texture_builder_set_fd(builder, 0, buffer->fd);
+    gdk_dmabuf_texture_builder_set_offset(builder, 0, gbm_bo_get_offset(buffer->bo, 0));
+    gdk_dmabuf_texture_builder_set_stride(builder, 0, buffer->stride);
+
+    GError *error = nullptr;
+    auto ref = new std::shared_ptr<ToplevelCaptureBuffer>(buffer);
+    auto texture = gdk_dmabuf_texture_builder_build(builder, dmabuf_texture_released, ref, &error);
+    g_object_unref(builder);
+    if (!texture)
+    {
+        std::cerr << "Cannot show window previews as dmabuf textures: " << error->message << std::endl;
+        g_error_free(error);
+        delete ref;
+        return {};
+    }
+
+    // Frames are not copied into the buffer while GTK may still draw it
+    buffer->in_use = true;
+    return Glib::wrap(texture);
+}
+
+#endif
+
+static void frame_handle_ready(void *data,
+    struct ext_image_copy_capture_frame_v1*)
+{
+    ToplevelCapture *capture = (ToplevelCapture*)data;
+    auto buffer = capture->frame_buffer;
+    uint64_t capture_us = g_get_monotonic_time() - capture->last_frame_request;
+    capture->stats.frames++;
+    capture->stats.capture_us    += capture_us;
+    capture->stats.max_capture_us = std::max(capture->stats.max_capture_us, capture_us);
+    if (buffer)
+    {
+        capture->stats.pixels += (uint64_t)buffer->width * buffer->height;
+    }
+
+    capture->finish_frame();
+
+    // Nothing changed since the last frame, the texture is still up to date
+    if (!buffer || (!capture->frame_damaged && capture->texture))
+    {
+        capture->schedule_next_frame();
+        return;
+    }
+
+    int64_t start = g_get_monotonic_time();
+    Glib::RefPtr<Gdk::Texture> texture;
+#if GTK_CHECK_VERSION(4, 14, 0)
+    if (capture->dmabuf_textures)
+    {
+        texture = capture_build_dmabuf_texture(buffer);
+        if (!texture)
+        {
+            capture->disable_dmabuf_textures();
+        }
+    }
+
+#endif
+    bool zero_copy = (bool)texture;
+    if (!zero_copy)
+    {
+        texture = capture_build_memory_texture(buffer.get(), capture->max_texture_width);
+    }
+
+    int64_t cpu_us = g_get_monotonic_time() - start;
+    capture->stats.cpu_us += cpu_us;
+    capture->schedule_next_frame();
+    if (texture)
+    {
+        capture->texture = texture;
+        capture->frame_signal.emit(cpu_us, zero_copy);
+    }
+}
+
+static void frame_handle_failed(void *data,
+    struct ext_image_copy_capture_frame_v1*,
+    uint32_t reason)
+{
+    ToplevelCapture *capture = (ToplevelCapture*)data;
+    auto buffer = capture->frame_buffer;
+    capture->stats.failed++;
+    capture->finish_frame();
+
+    // The content of the buffer is undefined now
+    if (buffer)
+    {
+        buffer->damage.add(0, 0, buffer->width, buffer->height);
+    }
+
+    // On new buffer constraints the buffer is reallocated for the next frame
+    if (reason != EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED)
+    {
+        capture->schedule_next_frame();
+    }
+}
+
+static const struct ext_image_copy_capture_frame_v1_listener frame_listener = {
+    .transform = frame_handle_transform,
+    .damage    = frame_handle_damage,
+    .presentation_time = frame_handle_presentation_time,
+    .ready  = frame_handle_ready,
+    .failed = frame_handle_failed,
+};
+
+void ToplevelCaptureDamage::add(int32_t x, int32_t y, int32_t width, int32_t height)
+{
+    if (empty())
+    {
+        x1 = x;
+        y1 = y;
+        x2 = x + width;
+        y2 = y + height;
+        return;
+    }
+
+    x1 = std::min(x1, x);
+    y1 = std::min(y1, y);
+    x2 = std::max(x2, x + width);
+    y2 = std::max(y2, y + height);
+}
+
+void ToplevelCaptureStats::add(const ToplevelCaptureStats& other)
+{
+    frames += other.frames;
+    failed += other.failed;
+    pixels += other.pixels;
+    capture_us    += other.capture_us;
+    max_capture_us = std::max(max_capture_us, other.max_capture_us);
+    cpu_us += other.cpu_us;
+}
+
+ToplevelCaptureBuffer::~ToplevelCaptureBuffer()
+{
+    scheduler->remove_memory((size_t)stride * height);
+
+    if (buffer)
+    {
+        wl_buffer_destroy(buffer);
+    }
+
+    if (params)
+    {
+        zwp_linux_buffer_params_v1_destroy(params);
+    }
+
+    if (fd > 0)
+    {
+        close(fd);
+    }
+
+    if (bo)
+    {
+        gbm_bo_destroy(bo);
+    }
+}
+
+static std::shared_ptr<ToplevelCaptureBuffer> frame_handle_linux_dmabuf(uint32_t width, uint32_t height,
+    ToplevelCapture *capture)
+{
+    if (!capture->context->dmabuf_device || !capture->context->dmabuf)
+    {
+        return nullptr;
+    }
+
+    // The session advertises DRM fourccs, whose values differ from wl_shm ones
+    uint32_t format = (capture->current_buffer_format == DRM_FORMAT_XRGB8888) ?
+        DRM_FORMAT_XRGB8888 : DRM_FORMAT_ARGB8888;
+
+    auto buffer = std::make_shared<ToplevelCaptureBuffer>();
+    buffer->owner     = capture;
+    buffer->scheduler = capture->scheduler;
+    buffer->context   = capture->context;
+
+    auto w = width;
+    auto h = height;
+
+    const uint64_t modifier = 0; // DRM_FORMAT_MOD_LINEAR
+    buffer->bo = gbm_bo_create_with_modifiers(capture->context->dmabuf_device, w, h,
+        format, &modifier, 1);
+    if (buffer->bo == NULL)
+    {
+        buffer->bo = gbm_bo_create(capture->context->dmabuf_device, w, h,
+            format, GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING);
+    }
+
+    if (buffer->bo == NULL)
+    {
+        perror("failed to create gbm bo");
+        return nullptr;
+    }
+
+    buffer->width  = gbm_bo_get_width(buffer->bo);
+    buffer->height = gbm_bo_get_height(buffer->bo);
+    buffer->stride = gbm_bo_get_stride(buffer->bo);
+    buffer->scheduler->add_memory((size_t)buffer->stride * buffer->height);
+    // The texture is imported with the fourcc the buffer was allocated with
+    buffer->format = gbm_bo_get_format(buffer->bo);
+    buffer->params = zwp_linux_dmabuf_v1_create_params(capture->context->dmabuf);
+
+    buffer->fd = gbm_bo_get_fd(buffer->bo);
+
+    uint64_t mod = gbm_bo_get_modifier(buffer->bo);
+    zwp_linux_buffer_params_v1_add(buffer->params,
+        buffer->fd, 0,
+        gbm_bo_get_offset(buffer->bo, 0),
+        gbm_bo_get_stride(buffer->bo),
+        mod >> 32, mod & 0xffffffff);
+
+    buffer->buffer = zwp_linux_buffer_params_v1_create_immed(buffer->params, w, h, format, 0);
+    // A new buffer has to be copied in full
+    buffer->damage.add(0, 0, buffer->width, buffer->height);
+    return buffer;
+}
+
+bool ToplevelCapture::request_next_frame()
+{
+    if ((current_buffer_width <= 0) || (current_buffer_height <= 0))
+    {
+        return false;
+    }
+
+    if (!recording_session || frame)
+    {
+        return false;
+    }
+
+    // Frames go into a buffer GTK is not drawing. Only the CPU path shows
+    // copies, so it always gets the first one.
+    std::shared_ptr<ToplevelCaptureBuffer> *slot = nullptr;
+    for (int i = 0; i < (dmabuf_textures ? 2 : 1); i++)
+    {
+        if (!buffers[i] || !buffers[i]->in_use)
+        {
+            slot = &buffers[i];
+            break;
+        }
+    }
+
+    if (!slot)
+    {
+        // Requested again when GTK releases one of them
+        return false;
+    }
+
+    auto& buffer = *slot;
+    if (!buffer || (buffer->width != current_buffer_width) || (buffer->height != current_buffer_height))
+    {
+        // Without room for two buffers, frames are copied to memory textures
+        // and a single buffer is enough
+        size_t bytes = (size_t)current_buffer_width * current_buffer_height * 4;
+        if ((slot == &buffers[0]) && dmabuf_textures && !scheduler->fits_memory(2 * bytes))
+        {
+            disable_dmabuf_textures();
+        }
+
+        if (buffer)
+        {
+            buffer->owner = nullptr;
+        }
+
+        buffer = frame_handle_linux_dmabuf(current_buffer_width, current_buffer_height, this);
+    }
+
+    if (!buffer || !buffer->buffer)
+    {
+        return false;
+    }
+
+    frame = ext_image_copy_capture_session_v1_create_frame(recording_session);
+    frame_buffer  = buffer;
+    frame_damaged = false;
+    frame_damage  = {};
+    last_frame_request = g_get_monotonic_time();
+
+    ext_image_copy_capture_frame_v1_add_listener(frame, &frame_listener, this);
+    ext_image_copy_capture_frame_v1_attach_buffer(frame, buffer->buffer);
+    // The buffer keeps its content between frames, only what changed since
+    // it was last copied into must be copied again. The compositor adds the
+    // damage of the window since the last frame.
+    if (!buffer->damage.empty())
+    {
+        ext_image_copy_capture_frame_v1_damage_buffer(frame, buffer->damage.x1, buffer->damage.y1,
+            buffer->damage.x2 - buffer->damage.x1, buffer->damage.y2 - buffer->damage.y1);
+        buffer->damage = {};
+    }
+
+    ext_image_copy_capture_frame_v1_capture(frame);
+    return true;
+}
+
+void ToplevelCapture::disable_dmabuf_textures()
+{
+    dmabuf_textures = false;
+
+    // The second buffer is only used by dmabuf textures, GTK keeps it alive
+    // while it still draws it
+    if (buffers[1])
+    {
+        buffers[1]->owner = nullptr;
+        buffers[1].reset();
+    }
+}
+
+void ToplevelCapture::schedule_next_frame()
+{
+    if (frame || frame_queued || !recording_session)
+    {
+        return;
+    }
+
+    // The compositor holds the frame back until the window is damaged, so an
+    // idle window costs no copies at all
+    frame_queued = true;
+    scheduler->queue_frame(this, last_frame_request + scheduler->get_frame_interval());
+}
+
+bool ToplevelCapture::start_queued_frame()
+{
+    frame_queued = false;
+    return request_next_frame();
+}
+
+void ToplevelCapture::finish_frame()
+{
+    if (frame)
+    {
+        ext_image_copy_capture_frame_v1_destroy(frame);
+        frame = nullptr;
+    }
+
+    // The other buffers missed the damage of this frame
+    for (auto& buffer : buffers)
+    {
+        if (buffer && (buffer != frame_buffer) && !frame_damage.empty())
+        {
+            buffer->damage.add(frame_damage.x1, frame_damage.y1,
+                frame_damage.x2 - frame_damage.x1, frame_damage.y2 - frame_damage.y1);
+        }
+    }
+
+    frame_buffer = nullptr;
+}
+
+size_t ToplevelCapture::get_buffer_bytes() const
+{
+    size_t bytes = 0;
+    for (auto& buffer : buffers)
+    {
+        if (buffer)
+        {
+            bytes += (size_t)buffer->stride * buffer->height;
+        }
+    }
+
+    return bytes;
+}
+
+void ToplevelCapture::stop()
+{
+    scheduler->remove(this);
+    frame_queued = false;
+    finish_frame();
+
+    if (recording_session)
+    {
+        ext_image_copy_capture_session_v1_destroy(recording_session);
+        recording_session = NULL;
+    }
+
+    if (copy_capture_source)
+    {
+        ext_image_capture_source_v1_destroy(copy_capture_source);
+        copy_capture_source = NULL;
+    }
+
+    // A buffer still shown by GTK is destroyed when it lets go of it
+    for (auto& buffer : buffers)
+    {
+        if (buffer)
+        {
+            buffer->owner = nullptr;
+            buffer.reset();
+        }
+    }
+}
+
+ToplevelCapture::ToplevelCapture(ext_foreign_toplevel_handle_v1 *ext_handle)
+{
+    this->context   = ToplevelCaptureContext::get_instance();
+    this->scheduler = TooltipMediaScheduler::get_instance();
+    if (!context->is_available() || !ext_handle)
+    {
+        return;
+    }
+
+    // The first frame is requested when the session sent its constraints
+    copy_capture_source = ext_foreign_toplevel_image_capture_source_manager_v1_create_source(
+        context->toplevel_capture_manager, ext_handle);
+    recording_session = ext_image_copy_capture_manager_v1_create_session(
+        context->copy_capture_manager, copy_capture_source, 0);
+    ext_image_copy_capture_session_v1_add_listener(recording_session, &recording_session_listener, this);
+}
+
+ToplevelCapture::~ToplevelCapture()
+{
+    stop();
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <gbm.h>
+#include <xf86drm.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <gtkmm.h>
+#include <ext-foreign-toplevel-list-v1-client-protocol.h>
+#include <ext-image-capture-source-v1-client-protocol.h>
+#include <ext-image-copy-capture-v1-client-protocol.h>
+#include <linux-dmabuf-unstable-v1-client-protocol.h>
+#include <wayland-client-protocol.h>
+#include "scheduler.hpp"
+
+struct WayfireListToplevel
+{
+    std::string title;
+    std::string app_id;
+    std::string identifier;
+};
+
+/**
+ * The globals needed to capture toplevels and the ext-foreign-toplevel-list
+ * handles of all toplevels, shared by the window lists and the workspace
+ * switchers of all outputs.
+ */
+class ToplevelCaptureContext
+{
+  public:
+    using type_signal_toplevel = sigc::signal<void (ext_foreign_toplevel_handle_v1*)>;
+
+    ToplevelCaptureContext();
+    ~ToplevelCaptureContext();
+
+    static std::shared_ptr<ToplevelCaptureContext> get_instance();
+
+    /* False if the compositor cannot capture toplevels */
+    bool is_available() const;
+    /* The view id Wayfire adds to the app id of toplevels, 0 if there is none */
+    static uint64_t get_view_id_from_full_app_id(const std::string& app_id);
+    /* The handle of the toplevel of the view, null if it is not known (yet) */
+    ext_foreign_toplevel_handle_v1 *find_toplevel(uint64_t view_id) const;
+
+    /* Emitted when a toplevel sent all of its properties */
+    type_signal_toplevel signal_toplevel_done()
+    {
+        return toplevel_done;
+    }
+
+    /* Emitted before the handle of a closed toplevel is destroyed */
+    type_signal_toplevel signal_toplevel_closed()
+    {
+        return toplevel_closed;
+    }
+
+    std::map<ext_foreign_toplevel_handle_v1*,
+        std::unique_ptr<WayfireListToplevel>> toplevels;
+    type_signal_toplevel toplevel_done, toplevel_closed;
+
+    ext_foreign_toplevel_list_v1 *foreign_toplevel_list     = NULL;
+    ext_image_copy_capture_manager_v1 *copy_capture_manager = NULL;
+    ext_foreign_toplevel_image_capture_source_manager_v1 *toplevel_capture_manager = NULL;
+    zwp_linux_dmabuf_feedback_v1 *feedback = nullptr;
+    zwp_linux_dmabuf_v1 *dmabuf = nullptr;
+    gbm_device *dmabuf_device   = nullptr;
+
+  private:
+    wl_registry *registry;
+
+    inline static std::weak_ptr<ToplevelCaptureContext> instance;
+};
+
+class ToplevelCapture;
+
+/* Bounding box of damaged buffer regions */
+struct ToplevelCaptureDamage
+{
+    int32_t x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+    bool empty() const
+    {
+        return (x2 <= x1) || (y2 <= y1);
+    }
+
+    void add(int32_t x, int32_t y, int32_t width, int32_t height);
+};
+
+/* A dmabuf frames are copied into. As a dmabuf texture, GTK may still draw
+ * it after its ToplevelCapture is gone, so it is reference counted. */
+struct ToplevelCaptureBuffer
+{
+    /* Null once the ToplevelCapture is gone or does not use the buffer anymore */
+    ToplevelCapture *owner = nullptr;
+    /* Counts the memory of the buffer until it is destroyed */
+    std::shared_ptr<TooltipMediaScheduler> scheduler;
+    /* Keeps the gbm device alive until the buffer is destroyed */
+    std::shared_ptr<ToplevelCaptureContext> context;
+    gbm_bo *bo = nullptr;
+    int fd     = -1;
+    zwp_linux_buffer_params_v1 *params = nullptr;
+    wl_buffer *buffer = nullptr;
+    uint32_t width    = 0, height = 0, stride = 0;
+    uint32_t format   = GBM_FORMAT_ARGB8888;
+    /* Regions which changed since a frame was last copied into it */
+    ToplevelCaptureDamage damage;
+    /* Shown by a dmabuf texture, frames must not be copied into it */
+    bool in_use = false;
+
+    ~ToplevelCaptureBuffer();
+};
+
+/* Totals over all frames of a capture */
+struct ToplevelCaptureStats
+{
+    uint64_t frames = 0;
+    uint64_t failed = 0;
+    /* Pixels copied by the compositor, at window resolution */
+    uint64_t pixels = 0;
+    /* From asking for a frame until it was ready */
+    uint64_t capture_us = 0, max_capture_us = 0;
+    /* Creating the textures of the frames */
+    uint64_t cpu_us = 0;
+
+    void add(const ToplevelCaptureStats& other);
+};
+
+/**
+ * Copies the content of a toplevel into dmabufs through ext-image-copy-capture
+ * and turns every changed frame into a texture. Frames are started by the
+ * TooltipMediaScheduler, so the live previews of the window lists and the
+ * thumbnails of the workspace switchers share its budgets.
+ *
+ * The buffers are shown as dmabuf textures, which GTK scales when drawing.
+ * Only if GTK cannot import them or they do not fit into the memory budget,
+ * frames are scaled down to max_texture_width and copied to memory.
+ */
+class ToplevelCapture
+{
+  public:
+    /* Emitted with the CPU time spent on the texture and whether it shows the buffer */
+    using type_signal_frame = sigc::signal<void (int64_t, bool)>;
+
+    ToplevelCapture(ext_foreign_toplevel_handle_v1 *ext_handle);
+    ~ToplevelCapture();
+
+    /* Queued frames of a higher priority are started first */
+    int priority = 0;
+    /* Width frames copied to memory are scaled down to */
+    uint32_t max_texture_width = UINT32_MAX;
+
+    /* The latest frame, null until the first one is ready */
+    Glib::RefPtr<Gdk::Texture> get_texture() const
+    {
+        return texture;
+    }
+
+    type_signal_frame signal_frame()
+    {
+        return frame_signal;
+    }
+
+    const ToplevelCaptureStats& get_stats() const
+    {
+        return stats;
+    }
+
+    /* Memory of the buffers currently used by the capture */
+    size_t get_buffer_bytes() const;
+
+    std::shared_ptr<ToplevelCaptureContext> context;
+    ext_image_copy_capture_frame_v1 *frame = NULL;
+    ext_image_capture_source_v1 *copy_capture_source     = NULL;
+    ext_image_copy_capture_session_v1 *recording_session = NULL;
+    /* Shared by all captures */
+    std::shared_ptr<TooltipMediaScheduler> scheduler;
+    /* Waiting for the scheduler, which keeps to the max frame rate and budgets */
+    bool frame_queued = false;
+    int64_t last_frame_request = 0;
+    /* The compositor sent damage for the frame in flight */
+    bool frame_damaged = false;
+    ToplevelCaptureDamage frame_damage;
+    uint32_t current_buffer_format = GBM_FORMAT_ARGB8888;
+    uint32_t current_buffer_width  = 0;
+    uint32_t current_buffer_height = 0;
+
+    /* Two buffers, so that a frame can be copied while the other one is shown */
+    std::shared_ptr<ToplevelCaptureBuffer> buffers[2];
+    /* The buffer of the frame in flight */
+    std::shared_ptr<ToplevelCaptureBuffer> frame_buffer;
+    /* Cleared when GTK cannot import the buffers, then they are copied to memory */
+    bool dmabuf_textures = true;
+    /* Copy frames to memory from now on, which needs a single buffer */
+    void disable_dmabuf_textures();
+
+    Glib::RefPtr<Gdk::Texture> texture;
+    ToplevelCaptureStats stats;
+    type_signal_frame frame_signal;
+
+    /* Queue the next frame with the scheduler, unless one is in flight or queued */
+    void schedule_next_frame();
+    /* Called by the scheduler. False if no frame was started, because there
+     * is no session, no free buffer or one is in flight already. */
+    bool start_queued_frame();
+    bool request_next_frame();
+    void finish_frame();
+    /* The toplevel cannot be captured anymore, the last texture stays */
+    void stop();
+};
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <wayfire/util/log.hpp>
+
+#include "scheduler.hpp"
+#include "capture.hpp"
+
+TooltipMediaScheduler::TooltipMediaScheduler()
+{
+    last_refill  = last_log = g_get_monotonic_time();
+    pixel_budget = get_rate();
+}
+
+TooltipMediaScheduler::~TooltipMediaScheduler()
+{
+    timer.disconnect();
+}
+
+std::shared_ptr<TooltipMediaScheduler> TooltipMediaScheduler::get_instance()
+{
+    auto scheduler = instance.lock();
+    if (!scheduler)
+    {
+        scheduler = std::make_shared<TooltipMediaScheduler>();
+        instance  = scheduler;
+    }
+
+    return scheduler;
+}
+
+double TooltipMediaScheduler::get_rate() const
+{
+    return std::max(pixel_rate.value(), 1.0) * 1e6;
+}
+
+int64_t TooltipMediaScheduler::get_frame_interval() const
+{
+    return 1000000 / std::clamp(max_fps.value(), 1, 60);
+}
+
+void TooltipMediaScheduler::queue_frame(ToplevelCapture *capture, int64_t not_before)
+{
+    auto it = std::find_if(queue.begin(), queue.end(),
+        [=] (const queued_frame_t& frame) { return frame.capture->priority < capture->priority; });
+    queue.insert(it, {capture, not_before});
+    dispatch();
+}
+
+void TooltipMediaScheduler::remove(ToplevelCapture *capture)
+{
+    queue.erase(std::remove_if(queue.begin(), queue.end(),
+        [=] (const queued_frame_t& frame) { return frame.capture == capture; }), queue.end());
+}
+
+bool TooltipMediaScheduler::fits_memory(size_t bytes) const
+{
+    return memory + bytes <= (size_t)std::max(memory_limit.value(), 0) * 1024 * 1024;
+}
+
+void TooltipMediaScheduler::add_memory(size_t bytes)
+{
+    memory += bytes;
+}
+
+void TooltipMediaScheduler::remove_memory(size_t bytes)
+{
+    memory -= std::min(memory, bytes);
+}
+
+void TooltipMediaScheduler::dispatch()
+{
+    timer.disconnect();
+
+    int64_t now = g_get_monotonic_time();
+    double rate = get_rate();
+    pixel_budget = std::min(rate, pixel_budget + rate * (now - last_refill) / 1e6);
+    last_refill  = now;
+
+    // Frames which are not due yet do not hold back the others
+    int64_t wake_up = INT64_MAX;
+    for (auto it = queue.begin(); it != queue.end();)
+    {
+        if (it->not_before > now)
+        {
+            wake_up = std::min(wake_up, it->not_before);
+            ++it;
+            continue;
+        }
+
+        auto capture = it->capture;
+        double cost  = (double)capture->current_buffer_width * capture->current_buffer_height;
+        if ((cost > pixel_budget) && (pixel_budget < rate))
+        {
+            // Earlier frames go first, so that large captures are not starved
+            delayed++;
+            double missing = std::min(cost, rate) - pixel_budget;
+            wake_up = std::min(wake_up, now + (int64_t)(missing / rate * 1e6));
+            break;
+        }
+
+        queue.erase(it);
+        // Only frames which are copied use up the budget
+        if (capture->start_queued_frame())
+        {
+            pixel_budget -= cost;
+            started++;
+        }
+
+        // The capture may have queued another frame or removed itself
+        it = queue.begin();
+    }
+
+    log_stats(now);
+    if (wake_up != INT64_MAX)
+    {
+        int delay_ms = std::max<int64_t>(1, (wake_up - now + 999) / 1000);
+        timer = Glib::signal_timeout().connect([this] ()
+        {
+            dispatch();
+            return false;
+        }, delay_ms);
+    }
+}
+
+void TooltipMediaScheduler::log_stats(int64_t now)
+{
+    if (now - last_log < 1000000)
+    {
+        return;
+    }
+
+    if (started || delayed)
+    {
+        LOGD("window capture scheduler: ", started, " frames started, ", delayed, " times delayed, ",
+            memory / 1024, " KiB of buffers");
+    }
+
+    started = delayed = 0;
+    last_log = now;
+}
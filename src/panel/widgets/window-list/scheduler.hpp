@@ -0,0 +1,69 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <vector>
+#include <glibmm.h>
+#include <wf-option-wrap.hpp>
+
+class ToplevelCapture;
+
+/**
+ * Decides when the live previews of all window lists and the thumbnails of
+ * all workspace switchers may copy their next frame, so that together they
+ * stay within a frame rate, a pixel rate and a memory budget.
+ *
+ * Frames are started by priority, and in the order they were asked for
+ * within a priority. Pixels come from a bucket refilled at the configured
+ * rate, a frame larger than the whole bucket is started once it is full.
+ * Large or many captures are thus updated less often instead of blocking
+ * each other or the main loop.
+ */
+class TooltipMediaScheduler
+{
+  public:
+    TooltipMediaScheduler();
+    ~TooltipMediaScheduler();
+
+    static std::shared_ptr<TooltipMediaScheduler> get_instance();
+
+    /* Start the next frame of the capture when the budget allows, not before not_before */
+    void queue_frame(ToplevelCapture *capture, int64_t not_before);
+    /* Forget a capture, its queued frame is not started anymore */
+    void remove(ToplevelCapture *capture);
+    /* Microseconds between two frames of the same capture */
+    int64_t get_frame_interval() const;
+
+    /* Whether buffers of the given size still fit into the memory budget */
+    bool fits_memory(size_t bytes) const;
+    /* Count capture buffers as they are created and destroyed */
+    void add_memory(size_t bytes);
+    void remove_memory(size_t bytes);
+
+  private:
+    struct queued_frame_t
+    {
+        ToplevelCapture *capture;
+        int64_t not_before;
+    };
+    std::deque<queued_frame_t> queue;
+
+    WfOption<int> max_fps{"panel/window_list_live_window_preview_max_fps"};
+    WfOption<double> pixel_rate{"panel/window_list_live_window_preview_pixel_rate"};
+    WfOption<int> memory_limit{"panel/window_list_live_window_preview_memory"};
+    /* Pixels which may still be copied, refilled at pixel_rate */
+    double pixel_budget = 0;
+    int64_t last_refill = 0;
+    size_t memory = 0;
+    sigc::connection timer;
+
+    /* Frames started and delayed since the last log */
+    uint64_t started = 0, delayed = 0;
+    int64_t last_log = 0;
+
+    inline static std::weak_ptr<TooltipMediaScheduler> instance;
+
+    double get_rate() const;
+    void dispatch();
+    void log_stats(int64_t now);
+};
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <gtkmm.h>
 
@@ -7,7 +8,7 @@
 
 #include <glibmm.h>
 #include <cassert>
-#include <sys/mman.h>
+#include <wayfire/util/log.hpp>
 
 #include "toplevel.hpp"
 #include "window-list.hpp"
@@ -18,321 +19,57 @@ namespace
 extern zwlr_foreign_toplevel_handle_v1_listener toplevel_handle_v1_impl;
 }
 
-static void session_handle_buffer_size(void *data,
-    struct ext_image_copy_capture_session_v1*,
-    uint32_t width, uint32_t height)
+void TooltipMedia::log_frame_time(int64_t cpu_us, bool zero_copy)
 {
-    TooltipMedia *toplevel = (TooltipMedia*)data;
-    toplevel->current_buffer_width  = width;
-    toplevel->current_buffer_height = height;
-}
-
-static void session_handle_shm_format(void *data,
-    struct ext_image_copy_capture_session_v1*,
-    uint32_t format)
-{}
-
-static void session_handle_dmabuf_device(void*,
-    struct ext_image_copy_capture_session_v1*,
-    struct wl_array*)
-{}
-
-static void session_handle_dmabuf_format(void *data,
-    struct ext_image_copy_capture_session_v1*,
-    uint32_t format,
-    struct wl_array*)
-{
-    TooltipMedia *toplevel = (TooltipMedia*)data;
-    toplevel->current_buffer_format = format;
-}
-
-static void session_handle_done(void *data,
-    struct ext_image_copy_capture_session_v1*)
-{}
-
-static void session_handle_stopped(void*,
-    struct ext_image_copy_capture_session_v1 *session)
-{}
-
-static const struct ext_image_copy_capture_session_v1_listener recording_session_listener = {
-    .buffer_size   = session_handle_buffer_size,
-    .shm_format    = session_handle_shm_format,
-    .dmabuf_device = session_handle_dmabuf_device,
-    .dmabuf_format = session_handle_dmabuf_format,
-    .done    = session_handle_done,
-    .stopped = session_handle_stopped,
-};
-
-/* Copy Capture Callbacks */
-
-static void frame_handle_transform(void*,
-    struct ext_image_copy_capture_frame_v1*,
-    uint32_t)
-{}
-
-static void frame_handle_damage(void*,
-    struct ext_image_copy_capture_frame_v1*,
-    int32_t, int32_t, int32_t, int32_t)
-{}
-
-static void frame_handle_presentation_time(void*,
-    struct ext_image_copy_capture_frame_v1*,
-    uint32_t, uint32_t, uint32_t)
-{}
-
-static void frame_handle_ready(void *data,
-    struct ext_image_copy_capture_frame_v1*)
-{
-    TooltipMedia *tooltip_media = (TooltipMedia*)data;
-
-    if (tooltip_media->buffer == nullptr)
-    {
-        printf("%s buffer null\n", __func__);
-
-        return;
-    }
-
-    uint32_t stride  = 0;
-    void *map_data   = NULL;
-    void *pixel_data = gbm_bo_map(tooltip_media->bo, 0, 0, tooltip_media->width, tooltip_media->height,
-        GBM_BO_TRANSFER_READ, &stride, &map_data);
-    if (!pixel_data)
-    {
-        perror("failed to map bo");
-        return;
-    }
-
-    /* Scale */
-    auto pixbuf = Gdk::Pixbuf::create_from_data(
-        (const guint8*)pixel_data,
-        Gdk::Colorspace::RGB,
-        true,
-        8,
-        tooltip_media->width,
-        tooltip_media->height,
-        stride);
-
-    gbm_bo_unmap(tooltip_media->bo, map_data);
-
-    uint32_t w = 500;
-    uint32_t h = tooltip_media->height * (500.0f / tooltip_media->width);
-
-    auto scaled_pixbuf = pixbuf->scale_simple(
-        w, h, Gdk::InterpType::BILINEAR);
-
-    w = scaled_pixbuf->get_width();
-    h = scaled_pixbuf->get_height();
-    uint32_t s = scaled_pixbuf->get_rowstride();
-
-    /* Swap red and blue channels */
-    size_t size = s * h;
-    pixel_data = scaled_pixbuf->get_pixels();
-    std::shared_ptr<Glib::Bytes> bytes = Glib::Bytes::create((unsigned char*)pixel_data, size);
-
-    if (!bytes)
-    {
-        return;
-    }
-
-    auto builder = Gdk::MemoryTextureBuilder::create();
-    builder->set_bytes(bytes);
-    builder->set_width(w);
-    builder->set_height(h);
-    builder->set_stride(s);
-    builder->set_format(Gdk::MemoryFormat::B8G8R8A8);
-
-    auto texture = builder->build();
-
-    tooltip_media->set_paintable(texture);
-}
-
-static void frame_handle_failed(void *data,
-    struct ext_image_copy_capture_frame_v1*,
-    uint32_t reason)
-{}
-
-static const struct ext_image_copy_capture_frame_v1_listener frame_listener = {
-    .transform = frame_handle_transform,
-    .damage    = frame_handle_damage,
-    .presentation_time = frame_handle_presentation_time,
-    .ready  = frame_handle_ready,
-    .failed = frame_handle_failed,
-};
-
-static void frame_handle_linux_dmabuf(uint32_t width, uint32_t height, TooltipMedia *tooltip_media)
-{
-    auto format = (tooltip_media->current_buffer_format == WL_SHM_FORMAT_XRGB8888) ?
-        GBM_FORMAT_XRGB8888 : GBM_FORMAT_ARGB8888;
-
-    if (tooltip_media->gbm_bo_fd > 0)
-    {
-        close(tooltip_media->gbm_bo_fd);
-    }
-
-    if (tooltip_media->bo)
-    {
-        gbm_bo_destroy(tooltip_media->bo);
-        tooltip_media->bo = nullptr;
-    }
-
-    if (tooltip_media->buffer)
-    {
-        wl_buffer_destroy(tooltip_media->buffer);
-        tooltip_media->buffer = nullptr;
-    }
-
-    if (tooltip_media->params)
-    {
-        zwp_linux_buffer_params_v1_destroy(tooltip_media->params);
-    }
-
-    auto w = width;
-    auto h = height;
-
-    const uint64_t modifier = 0; // DRM_FORMAT_MOD_LINEAR
-    tooltip_media->bo = gbm_bo_create_with_modifiers(tooltip_media->window_list->dmabuf_device, w, h,
-        format, &modifier, 1);
-    if (tooltip_media->bo == NULL)
-    {
-        tooltip_media->bo = gbm_bo_create(tooltip_media->window_list->dmabuf_device, w, h,
-            format, GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING);
-    }
+    frame_stats.frames++;
+    frame_stats.cpu_us    += cpu_us;
+    frame_stats.max_cpu_us = std::max(frame_stats.max_cpu_us, cpu_us);
 
-    if (tooltip_media->bo == NULL)
+    int64_t now = g_get_monotonic_time();
+    if (now - frame_stats.since >= 1000000)
     {
-        perror("failed to create gbm bo");
-        return;
+        LOGD("window preview: ", frame_stats.frames, " frames, ",
+            frame_stats.cpu_us / frame_stats.frames, " us CPU per frame on average, ",
+            frame_stats.max_cpu_us, " us at most (", zero_copy ? "dmabuf" : "memory", " textures)");
+        frame_stats = {};
+        frame_stats.since = now;
     }
-
-    tooltip_media->width  = gbm_bo_get_width(tooltip_media->bo);
-    tooltip_media->height = gbm_bo_get_height(tooltip_media->bo);
-    tooltip_media->stride = gbm_bo_get_stride(tooltip_media->bo);
-    tooltip_media->params = zwp_linux_dmabuf_v1_create_params(tooltip_media->window_list->dmabuf);
-
-    tooltip_media->gbm_bo_fd = gbm_bo_get_fd(tooltip_media->bo);
-
-    uint64_t mod = gbm_bo_get_modifier(tooltip_media->bo);
-    zwp_linux_buffer_params_v1_add(tooltip_media->params,
-        tooltip_media->gbm_bo_fd, 0,
-        gbm_bo_get_offset(tooltip_media->bo, 0),
-        gbm_bo_get_stride(tooltip_media->bo),
-        mod >> 32, mod & 0xffffffff);
-
-    tooltip_media->buffer = zwp_linux_buffer_params_v1_create_immed(tooltip_media->params, w, h, format, 0);
 }
 
-void TooltipMedia::request_next_frame()
+void TooltipMedia::measure_vfunc(Gtk::Orientation orientation, int for_size, int& minimum, int& natural,
+    int& minimum_baseline, int& natural_baseline) const
 {
-    if ((current_buffer_width <= 0) || (current_buffer_height <= 0))
-    {
-        return;
-    }
-
-    if (!recording_session)
-    {
-        return;
-    }
-
-    bool dirty = (width != current_buffer_width) || (height != current_buffer_height) ||
-        !buffer;
-
-    width  = current_buffer_width;
-    height = current_buffer_height;
-
-    if (dirty)
-    {
-        frame_handle_linux_dmabuf(width, height, this);
-    }
-
-    if (!buffer)
+    // Shown at most PREVIEW_WIDTH wide, whatever the size of the texture
+    minimum = natural = 0;
+    minimum_baseline  = natural_baseline = -1;
+    auto paintable = get_paintable();
+    if (!paintable || (paintable->get_intrinsic_width() <= 0))
     {
         return;
     }
 
-    if (frame)
-    {
-        ext_image_copy_capture_frame_v1_destroy(frame);
-    }
-
-    frame = ext_image_copy_capture_session_v1_create_frame(recording_session);
-
-    ext_image_copy_capture_frame_v1_add_listener(frame, &frame_listener, this);
-    ext_image_copy_capture_frame_v1_attach_buffer(frame, buffer);
-    ext_image_copy_capture_frame_v1_damage_buffer(frame, 0, 0, width, height);
-    ext_image_copy_capture_frame_v1_capture(frame);
-}
-
-void TooltipMedia::start_toplevel_source_session()
-{
-    copy_capture_source = ext_foreign_toplevel_image_capture_source_manager_v1_create_source(
-        this->window_list->toplevel_capture_manager,
-        this->ext_handle);
-    recording_session = ext_image_copy_capture_manager_v1_create_session(
-        this->window_list->copy_capture_manager,
-        copy_capture_source, 0);
-    ext_image_copy_capture_session_v1_add_listener(recording_session, &recording_session_listener, this);
+    double width = paintable->get_intrinsic_width();
+    double scale = std::min(1.0, PREVIEW_WIDTH / width);
+    minimum = natural = (orientation == Gtk::Orientation::HORIZONTAL) ?
+        width * scale : paintable->get_intrinsic_height() * scale;
 }
 
-TooltipMedia::TooltipMedia(WayfireWindowList *window_list, ext_foreign_toplevel_handle_v1 *ext_handle)
+TooltipMedia::TooltipMedia(ext_foreign_toplevel_handle_v1 *ext_handle) : capture(ext_handle)
 {
-    this->window_list = window_list;
-    this->ext_handle  = ext_handle;
-
-    start_toplevel_source_session();
-
-    timer_connection = Glib::signal_timeout().connect(
-        [this] ()
+    capture.priority = PRIORITY;
+    capture.max_texture_width = PREVIEW_WIDTH * get_scale_factor();
+    property_scale_factor().signal_changed().connect([=] ()
     {
-        if (!timer_continue)
-        {
-            return false;
-        }
-
-        this->request_next_frame();
-
-        return true;
-    }, 20);
-}
-
-TooltipMedia::~TooltipMedia()
-{
-    timer_connection.disconnect();
-    timer_continue = false;
-
-    if (frame)
-    {
-        ext_image_copy_capture_frame_v1_destroy(frame);
-    }
-
-    if (copy_capture_source)
-    {
-        ext_image_capture_source_v1_destroy(copy_capture_source);
-    }
-
-    if (recording_session)
-    {
-        ext_image_copy_capture_session_v1_destroy(recording_session);
-    }
-
-    if (this->buffer)
-    {
-        wl_buffer_destroy(this->buffer);
-    }
-
-    if (this->params)
-    {
-        zwp_linux_buffer_params_v1_destroy(this->params);
-    }
+        capture.max_texture_width = PREVIEW_WIDTH * get_scale_factor();
+    });
 
-    if (this->gbm_bo_fd > 0)
+    capture.signal_frame().connect([=] (int64_t cpu_us, bool zero_copy)
     {
-        close(this->gbm_bo_fd);
-    }
+        set_paintable(capture.get_texture());
+        log_frame_time(cpu_us, zero_copy);
+    });
 
-    if (this->bo)
-    {
-        gbm_bo_destroy(this->bo);
-    }
+    frame_stats.since = g_get_monotonic_time();
 }
 
 class WayfireToplevel::impl
@@ -488,13 +225,13 @@ class WayfireToplevel::impl
 
     void set_tooltip_media()
     {
-        if (this->tooltip_media || !this->window_list->toplevel_capture_manager ||
+        if (this->tooltip_media || !this->window_list->capture_context->is_available() ||
             !(bool)window_list->live_window_previews || !this->ext_handle)
         {
             return;
         }
 
-        this->tooltip_media = Gtk::make_managed<TooltipMedia>(this->window_list, this->ext_handle);
+        this->tooltip_media = Gtk::make_managed<TooltipMedia>(this->ext_handle);
         this->custom_tooltip_content.append(*this->tooltip_media);
     }
 
@@ -687,7 +424,8 @@ class WayfireToplevel::impl
             return false;
         }
 
-        if (this->window_list->list_toplevels.empty() || !this->window_list->toplevel_capture_manager ||
+        if (this->window_list->capture_context->toplevels.empty() ||
+            !this->window_list->capture_context->is_available() ||
             !(bool)window_list->live_window_previews || !this->ext_handle)
         {
             tooltip->set_text(title);
@@ -706,7 +444,7 @@ class WayfireToplevel::impl
 
         this->app_id = app_id;
         IconProvider::image_set_icon(image, app_id);
-        this->view_id = this->window_list->get_view_id_from_full_app_id(app_id);
+        this->view_id = ToplevelCaptureContext::get_view_id_from_full_app_id(app_id);
         if (this->view_id == 0)
         {
             std::cerr << "Failed to get view id from app_id. " <<
@@ -985,15 +723,10 @@ static void handle_toplevel_done(void *data, toplevel_t)
     auto impl = static_cast<WayfireToplevel::impl*>(data);
     auto window_list = impl->window_list;
 
-    auto wf_id = window_list->get_view_id_from_full_app_id(impl->get_app_id());
-    for (auto & list_toplevel : window_list->list_toplevels)
+    auto wf_id = ToplevelCaptureContext::get_view_id_from_full_app_id(impl->get_app_id());
+    if (auto handle = window_list->capture_context->find_toplevel(wf_id))
     {
-        auto id = window_list->get_view_id_from_full_app_id(list_toplevel.second->app_id);
-        if (wf_id == id)
-        {
-            impl->set_ext_handle(list_toplevel.first);
-            break;
-        }
+        impl->set_ext_handle(handle);
     }
 }
 
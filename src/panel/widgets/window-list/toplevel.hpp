@@ -1,21 +1,16 @@
 #pragma once
 
-#include <gbm.h>
-#include <xf86drm.h>
 #include <memory>
 #include <gtkmm/box.h>
 #include <gtkmm/picture.h>
 #include <cairomm/refptr.h>
 #include <cairomm/context.h>
 #include <wlr-foreign-toplevel-management-unstable-v1-client-protocol.h>
-#include <ext-foreign-toplevel-list-v1-client-protocol.h>
-#include <ext-image-capture-source-v1-client-protocol.h>
-#include <ext-image-copy-capture-v1-client-protocol.h>
-#include <linux-dmabuf-unstable-v1-client-protocol.h>
 #include <wayland-client-protocol.h>
 #include <wf-option-wrap.hpp>
 #include "wf-shell-app.hpp"
 #include "panel.hpp"
+#include "capture.hpp"
 
 class WayfireWindowList;
 class WayfireWindowListBox;
@@ -27,31 +22,31 @@ enum WayfireToplevelState
     WF_TOPLEVEL_STATE_MINIMIZED = (1 << 2),
 };
 
+/* The live preview of a toplevel, shown in the tooltip of its button */
 class TooltipMedia : public Gtk::Picture
 {
   public:
-    WayfireWindowList *window_list = nullptr;
-    wl_buffer *buffer = nullptr;
-    ext_foreign_toplevel_handle_v1 *ext_handle = NULL;
-    ext_image_copy_capture_frame_v1 *frame     = NULL;
-    ext_image_capture_source_v1 *copy_capture_source     = NULL;
-    ext_image_copy_capture_session_v1 *recording_session = NULL;
-    sigc::connection timer_connection;
-    bool timer_continue = true;
-    uint32_t current_buffer_format = GBM_FORMAT_ARGB8888;
-    uint32_t current_buffer_width = 0, width = -1;
-    uint32_t current_buffer_height = 0, height = -1;
-    uint32_t stride;
+    /* Width of the preview in the tooltip */
+    static constexpr int PREVIEW_WIDTH = 500;
+    /* Looked at while it is shown, so its frames go before switcher thumbnails */
+    static constexpr int PRIORITY = 3;
 
-    gbm_bo *bo = nullptr;
-    int gbm_bo_fd = -1;
-    zwp_linux_buffer_params_v1 *params = nullptr;
+    ToplevelCapture capture;
 
-    TooltipMedia(WayfireWindowList *window_list, ext_foreign_toplevel_handle_v1 *ext_handle);
-    ~TooltipMedia();
+    /* CPU time spent on the frames, logged every second */
+    struct
+    {
+        uint64_t frames = 0;
+        int64_t cpu_us  = 0, max_cpu_us = 0;
+        int64_t since   = 0;
+    } frame_stats;
+    void log_frame_time(int64_t cpu_us, bool zero_copy);
 
-    void start_toplevel_source_session();
-    void request_next_frame();
+    TooltipMedia(ext_foreign_toplevel_handle_v1 *ext_handle);
+
+  protected:
+    void measure_vfunc(Gtk::Orientation orientation, int for_size, int& minimum, int& natural,
+        int& minimum_baseline, int& natural_baseline) const override;
 };
 
 /* Represents a single opened toplevel window.
@@ -6,17 +6,6 @@
 #include "toplevel.hpp"
 #include "layout.hpp"
 
-#ifdef HAVE_DMABUF
-    #include <gbm.h>
-#endif // HAVE_DMABUF
-
-struct WayfireListToplevel
-{
-    std::string title;
-    std::string app_id;
-    std::string identifier;
-};
-
 class WayfireToplevel;
 
 class WayfireWindowList : public Gtk::Box, public WayfireWidget
@@ -29,13 +18,10 @@ class WayfireWindowList : public Gtk::Box, public WayfireWidget
   public:
     std::map<zwlr_foreign_toplevel_handle_v1*,
         std::unique_ptr<WayfireToplevel>> toplevels;
-    std::map<ext_foreign_toplevel_handle_v1*,
-        std::unique_ptr<WayfireListToplevel>> list_toplevels;
+    /* The ext toplevel handles and capture globals, shared with the other outputs */
+    std::shared_ptr<ToplevelCaptureContext> capture_context;
 
     zwlr_foreign_toplevel_manager_v1 *manager = NULL;
-    ext_foreign_toplevel_list_v1 *foreign_toplevel_list     = NULL;
-    ext_image_copy_capture_manager_v1 *copy_capture_manager = NULL;
-    ext_foreign_toplevel_image_capture_source_manager_v1 *toplevel_capture_manager = NULL;
     WayfireOutput *output;
     Gtk::ScrolledWindow scrolled_window;
 
@@ -46,8 +32,6 @@ class WayfireWindowList : public Gtk::Box, public WayfireWidget
     void handle_new_toplevel(zwlr_foreign_toplevel_handle_v1 *toplevel);
     void handle_toplevel_closed(zwlr_foreign_toplevel_handle_v1 *handle);
 
-    uint64_t get_view_id_from_full_app_id(const std::string& app_id);
-
     wayfire_config *get_config();
 
     void init(Gtk::Box *container) override;
@@ -87,11 +71,11 @@ class WayfireWindowList : public Gtk::Box, public WayfireWidget
     WfOption<bool> live_window_previews{"panel/window_list_live_window_previews"};
     void handle_new_wl_output(wl_output *output);
 
-    zwp_linux_dmabuf_feedback_v1 *feedback = nullptr;
-    zwp_linux_dmabuf_v1 *dmabuf = nullptr;
-    gbm_device *dmabuf_device   = nullptr;
-
   private:
+    sigc::connection capture_toplevel_done, capture_toplevel_closed;
+
+    void handle_capture_toplevel_done(ext_foreign_toplevel_handle_v1 *handle);
+    void handle_capture_toplevel_closed(ext_foreign_toplevel_handle_v1 *handle);
     int get_default_button_width();
     int get_target_button_width();
 };
@@ -0,0 +1,212 @@
+#include <cmath>
+
+#include "workspace-minimap.hpp"
+
+/* Gap left of and above each workspace, like the margins of the workspace widgets */
+static constexpr double CELL_MARGIN = 1;
+
+WayfireWorkspaceMinimap::WayfireWorkspaceMinimap(const WorkspaceMinimapModel& model) : model(model)
+{
+    add_css_class("workspace-minimap");
+
+    workspace_active.add_css_class("workspace");
+    workspace_active.add_css_class("active");
+    workspace_inactive.add_css_class("workspace");
+    workspace_inactive.add_css_class("inactive");
+    view_active.add_css_class("view");
+    view_active.add_css_class("active");
+    view_inactive.add_css_class("view");
+    view_inactive.add_css_class("inactive");
+    for (auto probe : {&workspace_active, &workspace_inactive, &view_active, &view_inactive})
+    {
+        probe->set_visible(false);
+        probe->set_parent(*this);
+    }
+
+    auto click_gesture = Gtk::GestureClick::create();
+    click_gesture->set_button(0);
+    click_gesture->signal_released().connect(sigc::mem_fun(*this, &WayfireWorkspaceMinimap::on_released));
+    add_controller(click_gesture);
+
+    auto scroll_controller = Gtk::EventControllerScroll::create();
+    scroll_controller->set_flags(Gtk::EventControllerScroll::Flags::VERTICAL);
+    scroll_controller->signal_scroll().connect(sigc::mem_fun(*this, &WayfireWorkspaceMinimap::on_scroll),
+        false);
+    add_controller(scroll_controller);
+}
+
+WayfireWorkspaceMinimap::~WayfireWorkspaceMinimap()
+{
+    for (auto probe : {&workspace_active, &workspace_inactive, &view_active, &view_inactive})
+    {
+        probe->unparent();
+    }
+}
+
+void WayfireWorkspaceMinimap::set_cell_size(double width, double height)
+{
+    if ((width == cell_width) && (height == cell_height))
+    {
+        return;
+    }
+
+    cell_width  = width;
+    cell_height = height;
+    queue_resize();
+}
+
+void WayfireWorkspaceMinimap::set_row_only(bool row_only)
+{
+    this->row_only = row_only;
+    queue_resize();
+}
+
+int WayfireWorkspaceMinimap::first_row() const
+{
+    return row_only ? model.current_y : 0;
+}
+
+int WayfireWorkspaceMinimap::row_count() const
+{
+    return row_only ? 1 : model.grid_height;
+}
+
+bool WayfireWorkspaceMinimap::workspace_at(double x, double y, int& ws_x, int& ws_y) const
+{
+    if ((cell_width <= 0) || (cell_height <= 0) || (x < 0) || (y < 0))
+    {
+        return false;
+    }
+
+    ws_x = std::floor(x / cell_width);
+    ws_y = std::floor(y / cell_height);
+    if ((ws_x >= model.grid_width) || (ws_y >= row_count()))
+    {
+        return false;
+    }
+
+    ws_y += first_row();
+    return true;
+}
+
+void WayfireWorkspaceMinimap::on_released(int count, double x, double y)
+{
+    int ws_x, ws_y;
+    if (workspace_at(x, y, ws_x, ws_y))
+    {
+        workspace_clicked.emit(ws_x, ws_y);
+    }
+}
+
+bool WayfireWorkspaceMinimap::on_scroll(double dx, double dy)
+{
+    scrolled.emit(dy > 0 ? 1 : -1);
+    return false;
+}
+
+void WayfireWorkspaceMinimap::measure_vfunc(Gtk::Orientation orientation, int for_size, int& minimum,
+    int& natural, int& minimum_baseline, int& natural_baseline) const
+{
+    if (orientation == Gtk::Orientation::HORIZONTAL)
+    {
+        minimum = natural = std::ceil(cell_width * model.grid_width);
+    } else
+    {
+        minimum = natural = std::ceil(cell_height * row_count());
+    }
+
+    minimum_baseline = natural_baseline = -1;
+}
+
+static void append_outline(const Glib::RefPtr<Gtk::Snapshot>& snapshot, const Gdk::RGBA& color,
+    float x, float y, float w, float h)
+{
+    snapshot->append_color(color, Gdk::Graphene::Rect(x, y, w, 1));
+    snapshot->append_color(color, Gdk::Graphene::Rect(x, y + h - 1, w, 1));
+    snapshot->append_color(color, Gdk::Graphene::Rect(x, y + 1, 1, h - 2));
+    snapshot->append_color(color, Gdk::Graphene::Rect(x + w - 1, y + 1, 1, h - 2));
+}
+
+void WayfireWorkspaceMinimap::snapshot_vfunc(const Glib::RefPtr<Gtk::Snapshot>& snapshot)
+{
+    if ((cell_width <= 0) || (cell_height <= 0))
+    {
+        return;
+    }
+
+    int rows = row_count();
+    int row_offset   = first_row();
+    auto ws_active   = workspace_active.get_color();
+    auto ws_inactive = workspace_inactive.get_color();
+    for (int y = 0; y < rows; y++)
+    {
+        for (int x = 0; x < model.grid_width; x++)
+        {
+            bool active = (x == model.current_x) && (y + row_offset == model.current_y);
+            snapshot->append_color(active ? ws_active : ws_inactive, Gdk::Graphene::Rect(
+                x * cell_width + CELL_MARGIN, y * cell_height + CELL_MARGIN,
+                cell_width - CELL_MARGIN, cell_height - CELL_MARGIN));
+        }
+    }
+
+    double scale_x  = cell_width / model.output_width;
+    double scale_y  = cell_height / model.output_height;
+    auto outline    = get_color();
+    auto v_active   = view_active.get_color();
+    auto v_inactive = view_inactive.get_color();
+    auto draw_view  = [&] (const IPCView& view)
+    {
+        double x = view.geometry.x * scale_x;
+        double y = (view.geometry.y - row_offset * model.output_height) * scale_y;
+        double w = view.geometry.width * scale_x;
+        double h = view.geometry.height * scale_y;
+
+        // Views are shown on the workspace their center is on, clipped to it
+        int ws_x = std::floor((x + w / 2) / cell_width);
+        int ws_y = std::floor((y + h / 2) / cell_height);
+        if ((ws_x < 0) || (ws_x >= model.grid_width) || (ws_y < 0) || (ws_y >= rows) ||
+            (w < 1) || (h < 1))
+        {
+            return;
+        }
+
+        bool active = (view.id == model.active_view_id);
+        snapshot->push_clip(Gdk::Graphene::Rect(ws_x * cell_width + CELL_MARGIN,
+            ws_y * cell_height + CELL_MARGIN, cell_width - CELL_MARGIN, cell_height - CELL_MARGIN));
+        auto thumbnail = model.thumbnails.find(view.id);
+        if (thumbnail != model.thumbnails.end())
+        {
+            snapshot->append_texture(thumbnail->second, Gdk::Graphene::Rect(x, y, w, h));
+        } else
+        {
+            snapshot->append_color(active ? v_active : v_inactive, Gdk::Graphene::Rect(x, y, w, h));
+        }
+
+        append_outline(snapshot, outline, x, y, w, h);
+        snapshot->pop();
+    };
+
+    // Drawn bottom to top, the active view last, on top of the others
+    const IPCView *active_view = nullptr;
+    for (int id : model.view_order)
+    {
+        auto view = model.views.find(id);
+        if (view == model.views.end())
+        {
+            continue;
+        }
+
+        if (id == model.active_view_id)
+        {
+            active_view = &view->second;
+        } else
+        {
+            draw_view(view->second);
+        }
+    }
+
+    if (active_view)
+    {
+        draw_view(*active_view);
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <gtkmm.h>
+#include <unordered_map>
+#include <vector>
+
+#include "wf-ipc-events.hpp"
+
+/* What the minimap draws, kept up to date by the workspace switcher */
+struct WorkspaceMinimapModel
+{
+    int output_id   = -1;
+    int grid_width  = 1, grid_height = 1;
+    int current_x   = 0, current_y = 0;
+    double output_width = 1, output_height = 1;
+    /* Views shown on the output, positioned relative to the top left workspace */
+    std::unordered_map<int, IPCView> views;
+    /* Stacking order of the views, bottom to top. May list views of other outputs. */
+    std::vector<int> view_order;
+    int active_view_id = -1;
+    /* Live thumbnails by view id, drawn instead of the view colour */
+    std::unordered_map<int, Glib::RefPtr<Gdk::Texture>> thumbnails;
+};
+
+/**
+ * Draws the workspaces of an output and the views on them as plain
+ * rectangles from a WorkspaceMinimapModel, instead of using a widget for
+ * each of them. Clicks are mapped to workspaces in code.
+ *
+ * The colours come from the CSS color of hidden child nodes, styled like
+ * the workspace and view widgets: .workspace.active, .workspace.inactive,
+ * .view.active and .view.inactive. View outlines use the color of the
+ * minimap itself.
+ */
+class WayfireWorkspaceMinimap : public Gtk::Widget
+{
+  public:
+    using type_signal_workspace = sigc::signal<void (int, int)>;
+    using type_signal_scroll    = sigc::signal<void (int)>;
+
+    WayfireWorkspaceMinimap(const WorkspaceMinimapModel& model);
+    ~WayfireWorkspaceMinimap() override;
+
+    /* Size of a single workspace in pixels */
+    void set_cell_size(double width, double height);
+    /* Show only the current row of workspaces instead of the whole grid */
+    void set_row_only(bool row_only);
+    /* Workspace at the given widget coordinates, false if there is none */
+    bool workspace_at(double x, double y, int& ws_x, int& ws_y) const;
+
+    /* Emitted with the coordinates of the workspace which was clicked */
+    type_signal_workspace signal_workspace_clicked()
+    {
+        return workspace_clicked;
+    }
+
+    /* Emitted with -1 or 1 when scrolled up or down */
+    type_signal_scroll signal_scrolled()
+    {
+        return scrolled;
+    }
+
+  protected:
+    void snapshot_vfunc(const Glib::RefPtr<Gtk::Snapshot>& snapshot) override;
+    void measure_vfunc(Gtk::Orientation orientation, int for_size, int& minimum, int& natural,
+        int& minimum_baseline, int& natural_baseline) const override;
+
+  private:
+    const WorkspaceMinimapModel& model;
+    double cell_width = 0, cell_height = 0;
+    bool row_only = false;
+
+    /* Never shown, only their style is used */
+    Gtk::Box workspace_active, workspace_inactive, view_active, view_inactive;
+
+    type_signal_workspace workspace_clicked;
+    type_signal_scroll scrolled;
+
+    int first_row() const;
+    int row_count() const;
+    void on_released(int count, double x, double y);
+    bool on_scroll(double dx, double dy);
+};
@@ -1,13 +1,18 @@
+#include <algorithm>
 #include <iostream>
 #include <gtkmm.h>
 #include <glibmm.h>
 
 #include <wf-option-wrap.hpp>
+#include <wayfire/util/log.hpp>
 
 #include "panel.hpp"
 #include "wf-popover.hpp"
 #include "workspace-switcher.hpp"
 
+/* A workspace switch without a reply by then is rolled back */
+static constexpr int WORKSPACE_SWITCH_TIMEOUT_MS = 2000;
+
 void WayfireWorkspaceSwitcher::init(Gtk::Box *container)
 {
     ipc_client = WayfirePanelApp::get().get_ipc_server_instance()->create_client();
@@ -23,16 +28,27 @@ void WayfireWorkspaceSwitcher::init(Gtk::Box *container)
 
     button = std::make_unique<WayfireMenuWidget>("panel", "workspace-switcher", "workspace_switcher");
 
-    ipc_client->subscribe(this, {"view-mapped"});
-    ipc_client->subscribe(this, {"view-focused"});
-    ipc_client->subscribe(this, {"view-unmapped"});
-    ipc_client->subscribe(this, {"view-minimized"});
-    ipc_client->subscribe(this, {"view-set-output"});
-    ipc_client->subscribe(this, {"view-geometry-changed"});
-    ipc_client->subscribe(this, {"output-layout-changed"});
-    ipc_client->subscribe(this, {"wset-workspace-changed"});
-
-    workspace_switcher_target_size_opt.set_callback([=] () {set_size();});
+    // The events are processed once for all outputs by the shared state,
+    // only the changes on this output reach the switcher
+    ipc_state = WayfireIPCState::get_instance();
+    state_signals.push_back(ipc_state->signal_output_view_changed(output_name).connect(
+        sigc::mem_fun(*this, &WayfireWorkspaceSwitcher::on_view_changed)));
+    state_signals.push_back(ipc_state->signal_output_view_removed(output_name).connect(
+        sigc::mem_fun(*this, &WayfireWorkspaceSwitcher::on_view_removed)));
+    state_signals.push_back(ipc_state->signal_output_wset_changed(output_name).connect(
+        sigc::mem_fun(*this, &WayfireWorkspaceSwitcher::on_wset_changed)));
+    state_signals.push_back(ipc_state->signal_outputs_changed().connect(
+        sigc::mem_fun(*this, &WayfireWorkspaceSwitcher::queue_rebuild)));
+    state_signals.push_back(ipc_state->signal_reset().connect(
+        sigc::mem_fun(*this, &WayfireWorkspaceSwitcher::queue_rebuild)));
+    state_watches.push_back(ipc_state->watch(IPCStateGroup::VIEWS));
+    state_watches.push_back(ipc_state->watch(IPCStateGroup::WORKSPACES));
+
+    workspace_switcher_target_size_opt.set_callback([=] ()
+    {
+        set_size();
+        update_minimap_size();
+    });
 
     auto mode_cb = ([=] ()
     {
@@ -42,7 +58,27 @@ void WayfireWorkspaceSwitcher::init(Gtk::Box *container)
             overlay.unparent();
         }
 
-        if (layout.value() == "row")
+        detach_minimap();
+        if (mini_grid.get_parent())
+        {
+            button->remove(mini_grid);
+        }
+
+        if (use_minimap())
+        {
+            minimap.set_row_only(layout.value() == "row");
+            if (layout.value() == "grid_popover")
+            {
+                button->set_popup_child(minimap);
+                button->set_child(mini_minimap);
+                switcher_box.append(*button);
+                button->open_on(1);
+            } else
+            {
+                switcher_box.append(minimap);
+                button->open_on(-1);
+            }
+        } else if (layout.value() == "row")
         {
             switcher_box.append(box);
             button->open_on(-1);
@@ -58,18 +94,33 @@ void WayfireWorkspaceSwitcher::init(Gtk::Box *container)
             button->open_on(1);
         }
 
-        get_wsets();
+        rebuild();
     });
     layout.set_callback(mode_cb);
+    render_mode.set_callback(mode_cb);
 
     workspace_switcher_render_views.set_callback([=] ()
     {
-        get_wsets();
+        rebuild();
     });
 
+    auto thumbnails_cb = ([=] ()
+    {
+        release_thumbnails();
+        if (workspace_switcher_thumbnails.value())
+        {
+            thumbnails = WayfireWorkspaceThumbnails::get_instance();
+            thumbnail_signal = thumbnails->signal_updated().connect(
+                sigc::mem_fun(*this, &WayfireWorkspaceSwitcher::on_thumbnail_updated));
+            update_thumbnails();
+        }
+    });
+    workspace_switcher_thumbnails.set_callback(thumbnails_cb);
+
     switcher_box.add_css_class("workspace-switcher");
 
     container->append(switcher_box);
+    thumbnails_cb();
     mode_cb();
 }
 
@@ -109,27 +160,70 @@ void WayfireWorkspaceSwitcher::set_size()
     workspace_switcher_target_size = val;
 }
 
-void WayfireWorkspaceSwitcher::get_wsets()
+void WayfireWorkspaceSwitcher::rebuild()
 {
-    ipc_client->send("{\"method\":\"window-rules/list-wsets\"}", [=] (wf::json_t data)
+    if (!ipc_state->is_ready(IPCStateGroup::VIEWS) || !ipc_state->is_ready(IPCStateGroup::WORKSPACES))
     {
-        if (data.serialize().find("error") != std::string::npos)
+        // Rebuilt when the state is loaded
+        return;
+    }
+
+    // Everything is known locally, there is no round trip to the compositor
+    auto output = ipc_state->get_output(output_name);
+    auto wset   = output ? ipc_state->get_output_wset(output->id) : nullptr;
+    if (!wset)
+    {
+        return;
+    }
+
+    // Switches sent for another wset or outside of the grid cannot be shown
+    optimistic_switches.erase(std::remove_if(optimistic_switches.begin(), optimistic_switches.end(),
+        [&] (const optimistic_switch_t& sw)
+    {
+        return (wset->index != ipc_wset_index) || (sw.x >= wset->grid_width) ||
+               (sw.y >= wset->grid_height);
+    }), optimistic_switches.end());
+
+    this->ipc_output_id  = output->id;
+    this->ipc_wset_index = wset->index;
+    this->ipc_ws_x       = wset->workspace_x;
+    this->ipc_ws_y       = wset->workspace_y;
+    this->output_width   = output->geometry.width;
+    this->output_height  = output->geometry.height;
+    this->grid_width     = wset->grid_width;
+    this->grid_height    = wset->grid_height;
+    set_size();
+
+    // The boxes show where the switcher already switched to, even if Wayfire
+    // did not confirm it yet
+    IPCWset shown_wset = *wset;
+    std::tie(shown_wset.workspace_x, shown_wset.workspace_y) = get_shown_workspace();
+
+    bool render_views = workspace_switcher_render_views.value();
+    if (use_minimap())
+    {
+        minimap_process(shown_wset);
+        if (render_views)
         {
-            std::cerr << data.serialize() << std::endl;
-            std::cerr << "Error getting wsets list for workspace-switcher widget!" << std::endl;
-            return;
+            minimap_render_views();
         }
-
-        if (layout.value() == "row")
+    } else if (layout.value() == "row")
+    {
+        process_workspaces(shown_wset);
+        if (render_views)
         {
-            process_workspaces(data);
-        } else // "grid"/"grid_popover"
+            this->render_views();
+        }
+    } else // "grid"/"grid_popover"
+    {
+        grid_process_workspaces(shown_wset);
+        if (render_views)
         {
-            grid_process_workspaces(data);
+            grid_render_views();
         }
+    }
 
-        set_size();
-    });
+    update_thumbnails();
 }
 
 void WayfireWorkspaceSwitcher::clear_switcher_box()
@@ -165,34 +259,130 @@ void WayfireWorkspaceSwitcher::clear_box()
     windows.clear();
 }
 
-std::pair<int, int> WayfireWorkspaceSwitcher::get_workspace(WayfireWorkspaceBox *ws,
-    WayfireWorkspaceWindow *w)
+WayfireWorkspaceWindowPlacement WayfireWorkspaceSwitcher::place_view(const IPCView& view)
 {
-    std::pair<int, int> workspace;
-    auto size = ws->get_scaled_size();
+    auto size = get_scaled_size();
     double scaled_output_width  = size.first;
     double scaled_output_height = size.second;
-    workspace.first  = std::floor((w->x + (w->w / 2)) / scaled_output_width) + this->current_ws_x;
-    workspace.second = std::floor((w->y + (w->h / 2)) / scaled_output_height) + this->current_ws_y;
-    return workspace;
+
+    WayfireWorkspaceWindowPlacement placement;
+    double x = view.geometry.x * (scaled_output_width / float(this->output_width));
+    double y = view.geometry.y * (scaled_output_height / float(this->output_height));
+    placement.w = (view.geometry.width / float(this->output_width)) * scaled_output_width;
+    placement.h = (view.geometry.height / float(this->output_height)) * scaled_output_height;
+    int x_offset = std::floor((x + (placement.w / 2)) / scaled_output_width);
+    int y_offset = std::floor((y + (placement.h / 2)) / scaled_output_height);
+    placement.x_index = x_offset + this->ipc_ws_x;
+    placement.y_index = y_offset + this->ipc_ws_y;
+    // The view geometry is relative to the current workspace, keep the placement
+    // relative to the view's own workspace so that it survives workspace changes
+    placement.x = x - x_offset * scaled_output_width;
+    placement.y = y - y_offset * scaled_output_height;
+    return placement;
 }
 
-std::pair<int, int> WayfireWorkspaceSwitcher::grid_get_workspace(WayfireWorkspaceWindow *w)
+void WayfireWorkspaceWindow::set_placement(const WayfireWorkspaceWindowPlacement& placement)
 {
-    std::pair<int, int> workspace;
-    auto size = this->get_scaled_size();
-    double scaled_output_width  = size.first;
-    double scaled_output_height = size.second;
-    workspace.first  = std::floor((w->x + (w->w / 2)) / scaled_output_width) + this->current_ws_x;
-    workspace.second = std::floor((w->y + (w->h / 2)) / scaled_output_height) + this->current_ws_y;
-    return workspace;
+    x = placement.x;
+    y = placement.y;
+    w = placement.w;
+    h = placement.h;
+    x_index = placement.x_index;
+    y_index = placement.y_index;
+}
+
+void WayfireWorkspaceWindow::set_thumbnail(const Glib::RefPtr<Gdk::Texture>& texture)
+{
+    thumbnail = texture;
+    queue_draw();
+}
+
+void WayfireWorkspaceWindow::snapshot_vfunc(const Glib::RefPtr<Gtk::Snapshot>& snapshot)
+{
+    if (thumbnail)
+    {
+        snapshot->append_texture(thumbnail, Gdk::Graphene::Rect(0, 0, get_width(), get_height()));
+    }
+}
+
+bool WayfireWorkspaceSwitcher::should_show_view(const IPCView& view)
+{
+    return view.is_toplevel() && (view.output_name == this->output_name) && !view.minimized;
+}
+
+WayfireWorkspaceWindow*WayfireWorkspaceSwitcher::find_window(int view_id)
+{
+    auto it = windows.find(view_id);
+    return (it == windows.end()) ? nullptr : it->second;
+}
+
+WayfireWorkspaceBox*WayfireWorkspaceSwitcher::find_box(int x_index, int y_index)
+{
+    for (auto widget : box.get_children())
+    {
+        WayfireWorkspaceBox *ws = (WayfireWorkspaceBox*)widget;
+        if ((ws->x_index == x_index) && (ws->y_index == y_index))
+        {
+            return ws;
+        }
+    }
+
+    return nullptr;
+}
+
+WayfireWorkspaceWindow*WayfireWorkspaceSwitcher::create_window(const IPCView& view)
+{
+    auto v = Gtk::make_managed<WayfireWorkspaceWindow>();
+    v->add_css_class("view");
+    v->add_css_class(view.app_id);
+    v->id = view.id;
+    if (view.activated || (v->id == this->active_view_id))
+    {
+        auto old_window = find_window(this->active_view_id);
+        if (old_window && (old_window->id != v->id))
+        {
+            old_window->remove_css_class("active");
+            old_window->add_css_class("inactive");
+            old_window->active = false;
+        }
+
+        v->add_css_class("active");
+        v->active = true;
+        this->active_view_id = v->id;
+    } else
+    {
+        v->add_css_class("inactive");
+        v->active = false;
+    }
+
+    v->output_id = view.output_id;
+    v->set_can_target(false);
+    log_window_created();
+    return v;
+}
+
+void WayfireWorkspaceSwitcher::log_window_created()
+{
+    window_widgets_created++;
+
+    int64_t now = g_get_monotonic_time();
+    if (creation_log_since == 0)
+    {
+        creation_log_since = now;
+    } else if (now - creation_log_since >= 1000000)
+    {
+        LOGD("workspace-switcher ", output_name, ": ", window_widgets_created,
+            " window widgets created in ", (now - creation_log_since) / 1000, " ms");
+        window_widgets_created = 0;
+        creation_log_since     = now;
+    }
 }
 
 bool WayfireWorkspaceSwitcher::on_get_child_position(Gtk::Widget *widget, Gdk::Rectangle& allocation)
 {
     if (auto w = static_cast<WayfireWorkspaceWindow*>(widget))
     {
-        allocation.set_x(w->x + (this->current_ws_x - w->x_index) * w->ws->get_width());
+        allocation.set_x(w->x);
         allocation.set_y(w->y);
         allocation.set_width(w->w);
         allocation.set_height(w->h);
@@ -207,8 +397,8 @@ bool WayfireWorkspaceSwitcher::on_grid_get_child_position(Gtk::Widget *widget, G
     if (auto w = static_cast<WayfireWorkspaceWindow*>(widget))
     {
         auto size = this->get_scaled_size();
-        allocation.set_x(w->x + this->current_ws_x * size.first);
-        allocation.set_y(w->y + this->current_ws_y * size.second);
+        allocation.set_x(w->x + w->x_index * size.first);
+        allocation.set_y(w->y + w->y_index * size.second);
         allocation.set_width(w->w);
         allocation.set_height(w->h);
         return true;
@@ -219,66 +409,12 @@ bool WayfireWorkspaceSwitcher::on_grid_get_child_position(Gtk::Widget *widget, G
 
 void WayfireWorkspaceBox::on_switch_grid_clicked(int count, double x, double y)
 {
-    wf::json_t workspace_switch_request;
-    workspace_switch_request["method"] = "vswitch/set-workspace";
-    wf::json_t workspace;
-    workspace["x"] = this->switcher->current_ws_x = this->x_index;
-    workspace["y"] = this->switcher->current_ws_y = this->y_index;
-    workspace["output-id"] = this->output_id;
-    workspace_switch_request["data"] = workspace;
-    this->switcher->ipc_client->send(workspace_switch_request.serialize(), [=] (wf::json_t data)
-    {
-        if (data.serialize().find("error") != std::string::npos)
-        {
-            std::cerr << data.serialize() << std::endl;
-            std::cerr << "Error switching workspaces. Is vswitch plugin enabled?" << std::endl;
-        }
-    });
-    for (auto widget : this->switcher->mini_grid.get_children())
-    {
-        WayfireWorkspaceBox *ws = (WayfireWorkspaceBox*)widget;
-        if ((ws->x_index == this->x_index) && (ws->y_index == this->y_index))
-        {
-            ws->remove_css_class("inactive");
-            ws->add_css_class("active");
-        } else
-        {
-            ws->add_css_class("inactive");
-            ws->remove_css_class("active");
-        }
-    }
+    this->switcher->switch_to_workspace(this->x_index, this->y_index);
 }
 
 void WayfireWorkspaceBox::on_workspace_clicked(int count, double x, double y)
 {
-    wf::json_t workspace_switch_request;
-    workspace_switch_request["method"] = "vswitch/set-workspace";
-    wf::json_t workspace;
-    workspace["x"] = this->switcher->current_ws_x = this->x_index;
-    workspace["y"] = this->switcher->current_ws_y = this->y_index;
-    workspace["output-id"] = this->output_id;
-    workspace_switch_request["data"] = workspace;
-    this->switcher->ipc_client->send(workspace_switch_request.serialize(), [=] (wf::json_t data)
-    {
-        if (data.serialize().find("error") != std::string::npos)
-        {
-            std::cerr << data.serialize() << std::endl;
-            std::cerr << "Error switching workspaces. Is vswitch plugin enabled?" << std::endl;
-        }
-    });
-    for (auto widget : this->switcher->box.get_children())
-    {
-        WayfireWorkspaceBox *ws = (WayfireWorkspaceBox*)widget;
-        if ((ws->x_index == this->x_index) && (ws->y_index == this->y_index))
-        {
-            ws->remove_css_class("inactive");
-            ws->add_css_class("active");
-        } else
-        {
-            ws->add_css_class("inactive");
-            ws->remove_css_class("active");
-        }
-    }
+    this->switcher->switch_to_workspace(this->x_index, this->y_index);
 }
 
 std::pair<double, double> WayfireWorkspaceSwitcher::get_scaled_size()
@@ -307,67 +443,25 @@ std::pair<int, int> WayfireWorkspaceBox::get_scaled_size()
 
 bool WayfireWorkspaceBox::on_workspace_scrolled(double x, double y)
 {
-    for (auto widget : this->switcher->box.get_children())
-    {
-        WayfireWorkspaceBox *ws = (WayfireWorkspaceBox*)widget;
-        if (y > 0)
-        {
-            if (ws->y_index < ws->switcher->grid_height - 1)
-            {
-                ws->y_index++;
-            }
-        } else
-        {
-            if (ws->y_index > 0)
-            {
-                ws->y_index--;
-            }
-        }
-    }
-
-    wf::json_t workspace_switch_request;
-    workspace_switch_request["method"] = "vswitch/set-workspace";
-    wf::json_t workspace;
-    workspace["x"] = this->switcher->current_ws_x = this->x_index;
-    workspace["y"] = this->switcher->current_ws_y = this->y_index;
-    workspace["output-id"] = this->output_id;
-    workspace_switch_request["data"] = workspace;
-    this->switcher->ipc_client->send(workspace_switch_request.serialize(), [=] (wf::json_t data)
+    int y_index = std::clamp(this->y_index + (y > 0 ? 1 : -1), 0, this->switcher->grid_height - 1);
+    if (y_index != this->y_index)
     {
-        if (data.serialize().find("error") != std::string::npos)
-        {
-            std::cerr << data.serialize() << std::endl;
-            std::cerr << "Error switching workspaces. Is vswitch plugin enabled?" << std::endl;
-        }
-    });
-    for (auto widget : this->switcher->box.get_children())
-    {
-        WayfireWorkspaceBox *ws = (WayfireWorkspaceBox*)widget;
-        if ((ws->x_index == this->x_index) && (ws->y_index == this->y_index))
-        {
-            ws->remove_css_class("inactive");
-            ws->add_css_class("active");
-        } else
-        {
-            ws->add_css_class("inactive");
-            ws->remove_css_class("active");
-        }
+        this->switcher->switch_to_workspace(this->x_index, y_index);
     }
 
     return false;
 }
 
-void WayfireWorkspaceSwitcher::render_workspace(wf::json_t workspace, int j, int output_id, int output_width,
-    int output_height)
+void WayfireWorkspaceSwitcher::render_workspace(const IPCWset& wset, int j)
 {
     auto ws = Gtk::make_managed<WayfireWorkspaceBox>(this);
     ws->x_index   = j;
-    ws->y_index   = workspace["workspace"]["y"].as_int();
-    ws->output_id = output_id;
+    ws->y_index   = wset.workspace_y;
+    ws->output_id = ipc_output_id;
     ws->output_width  = output_width;
     ws->output_height = output_height;
     ws->add_css_class("workspace");
-    if (workspace["workspace"]["x"].as_int() == j)
+    if (wset.workspace_x == j)
     {
         ws->add_css_class("active");
         this->current_ws_x = j;
@@ -394,608 +488,711 @@ void WayfireWorkspaceSwitcher::render_workspace(wf::json_t workspace, int j, int
     ws->add_controller(click_gesture);
     ws->add_controller(scroll_controller);
     box.append(*ws);
-    if (workspace_switcher_render_views.value() && (j == this->grid_width - 1))
-    {
-        ipc_client->send("{\"method\":\"window-rules/list-views\"}", [=] (wf::json_t data)
-        {
-            if (data.serialize().find("error") != std::string::npos)
-            {
-                std::cerr << data.serialize() << std::endl;
-                std::cerr << "Error getting views list for workspace-switcher widget!" << std::endl;
-                return;
-            }
-
-            render_views(data);
-        });
-    }
 }
 
-void WayfireWorkspaceSwitcher::process_workspaces(wf::json_t workspace_data)
+void WayfireWorkspaceSwitcher::process_workspaces(const IPCWset& wset)
 {
-    size_t i = 0;
+    clear_box();
+    for (int j = 0; j < this->grid_width; j++)
+    {
+        render_workspace(wset, j);
+    }
 
-    this->grid_width  = workspace_data[i]["workspace"]["grid_width"].as_int();
-    this->grid_height = workspace_data[i]["workspace"]["grid_height"].as_int();
+    this->rendered_row = wset.workspace_y;
+}
 
-    for (i = 0; i < workspace_data.size(); i++)
-    {
-        wf::json_t output_info_request;
-        output_info_request["method"] = "window-rules/output-info";
-        wf::json_t output_id;
-        output_id["id"] = workspace_data[i]["output-id"].as_int();
-        output_info_request["data"] = output_id;
-        ipc_client->send(output_info_request.serialize(), [=] (wf::json_t output_data)
+void WayfireWorkspaceSwitcher::grid_process_workspaces(const IPCWset& wset)
+{
+    clear_box();
+    button->set_popup_child(overlay);
+    overlay.set_child(switch_grid);
+    overlay.add_css_class("workspace");
+    // Connected again on each rebuild, the old handler must go
+    grid_position_signal.disconnect();
+    grid_position_signal = overlay.signal_get_child_position().connect(sigc::mem_fun(*this,
+        &WayfireWorkspaceSwitcher::on_grid_get_child_position), false);
+    for (int j = 0; j < this->grid_height; j++)
+    {
+        for (int k = 0; k < this->grid_width; k++)
         {
-            if (output_data.serialize().find("error") != std::string::npos)
+            auto ws = Gtk::make_managed<WayfireWorkspaceBox>(this);
+            ws->output_id = ipc_output_id;
+            ws->set_can_target(false);
+            auto size     = this->get_scaled_size();
+            auto ws_width = size.first / this->grid_width;
+            auto ws_height = size.second / this->grid_height;
+            ws->set_size_request(ws_width, ws_height);
+            ws->add_css_class("workspace");
+            if ((wset.workspace_x == k) && (wset.workspace_y == j))
             {
-                std::cerr << output_data.serialize() << std::endl;
-                std::cerr << "Error getting output information!" << std::endl;
-                return;
+                ws->add_css_class("active");
+                this->current_ws_x = k;
+                this->current_ws_y = j;
+            } else
+            {
+                ws->add_css_class("inactive");
             }
 
-            if (this->output_name == output_data["name"].as_string())
+            ws->x_index = k;
+            ws->y_index = j;
+            mini_grid.attach(*ws, ws->x_index, ws->y_index, 1, 1);
+
+            ws = Gtk::make_managed<WayfireWorkspaceBox>(this);
+            ws->output_id = ipc_output_id;
+            ws->set_size_request(size.first, size.second);
+            ws->add_css_class("workspace");
+            if ((wset.workspace_x == k) && (wset.workspace_y == j))
             {
-                auto output_id = output_data["id"].as_int();
-                if (output_data["geometry"]["width"].is_int())
-                {
-                    this->output_width  = output_data["geometry"]["width"].as_int();
-                    this->output_height = output_data["geometry"]["height"].as_int();
-                } else
-                {
-                    this->output_width  = output_data["geometry"]["width"].as_double();
-                    this->output_height = output_data["geometry"]["height"].as_double();
-                }
-
-                for (auto w : windows)
-                {
-                    if (w->active)
-                    {
-                        this->active_view_id = w->id;
-                        break;
-                    }
-                }
-
-                clear_box();
-                for (int j = 0; j < this->grid_width; j++)
-                {
-                    render_workspace(workspace_data[i], j, output_id, output_width, output_height);
-                }
+                ws->add_css_class("active");
+                this->current_ws_x = k;
+                this->current_ws_y = j;
+            } else
+            {
+                ws->add_css_class("inactive");
             }
-        });
+
+            ws->x_index = k;
+            ws->y_index = j;
+            auto popover_click_gesture = Gtk::GestureClick::create();
+            popover_click_gesture->set_button(0);
+            popover_click_gesture->signal_released().connect(sigc::mem_fun(*ws,
+                &WayfireWorkspaceBox::on_switch_grid_clicked));
+            ws->add_controller(popover_click_gesture);
+            switch_grid.attach(*ws, ws->x_index, ws->y_index, 1, 1);
+        }
     }
 }
 
-void WayfireWorkspaceSwitcher::grid_process_workspaces(wf::json_t workspace_data)
+void WayfireWorkspaceSwitcher::add_view(const IPCView& view)
 {
-    size_t i = 0;
+    if (!should_show_view(view) || find_window(view.id))
+    {
+        return;
+    }
+
+    auto placement = place_view(view);
+    auto ws = find_box(placement.x_index, placement.y_index);
+    if (!ws)
+    {
+        return;
+    }
+
+    auto v = create_window(view);
+    v->set_placement(placement);
+    v->ws = ws;
+    // add to workspace box
+    ws->add_overlay(*v);
+    windows[v->id] = v;
+}
 
-    this->grid_width  = workspace_data[i]["workspace"]["grid_width"].as_int();
-    this->grid_height = workspace_data[i]["workspace"]["grid_height"].as_int();
+void WayfireWorkspaceSwitcher::update_view(const IPCView& view)
+{
+    auto w = find_window(view.id);
+    if (!w)
+    {
+        add_view(view);
+        return;
+    }
 
-    for (i = 0; i < workspace_data.size(); i++)
+    auto placement = place_view(view);
+    auto ws = should_show_view(view) ? find_box(placement.x_index, placement.y_index) : nullptr;
+    if (!ws)
     {
-        wf::json_t output_info_request;
-        output_info_request["method"] = "window-rules/output-info";
-        wf::json_t output_id;
-        output_id["id"] = workspace_data[i]["output-id"].as_int();
-        output_info_request["data"] = output_id;
-        ipc_client->send(output_info_request.serialize(), [=] (wf::json_t output_data)
-        {
-            if (output_data.serialize().find("error") != std::string::npos)
-            {
-                std::cerr << output_data.serialize() << std::endl;
-                std::cerr << "Error getting output information!" << std::endl;
-                return;
-            }
+        remove_view(view.id);
+        return;
+    }
 
-            if (this->output_name == output_data["name"].as_string())
-            {
-                if (output_data["geometry"]["width"].is_int())
-                {
-                    this->output_width  = output_data["geometry"]["width"].as_int();
-                    this->output_height = output_data["geometry"]["height"].as_int();
-                } else
-                {
-                    this->output_width  = output_data["geometry"]["width"].as_double();
-                    this->output_height = output_data["geometry"]["height"].as_double();
-                }
-
-                for (auto w : windows)
-                {
-                    if (w->active)
-                    {
-                        this->active_view_id = w->id;
-                        break;
-                    }
-                }
-
-                clear_box();
-                button->set_popup_child(overlay);
-                overlay.set_child(switch_grid);
-                overlay.add_css_class("workspace");
-                overlay.signal_get_child_position().connect(sigc::mem_fun(*this,
-                    &WayfireWorkspaceSwitcher::on_grid_get_child_position), false);
-                for (int j = 0; j < this->grid_height; j++)
-                {
-                    for (int k = 0; k < this->grid_width; k++)
-                    {
-                        auto ws = Gtk::make_managed<WayfireWorkspaceBox>(this);
-                        ws->output_id = output_data["id"].as_int();
-                        ws->set_can_target(false);
-                        auto size     = this->get_scaled_size();
-                        auto ws_width = size.first / this->grid_width;
-                        auto ws_height = size.second / this->grid_height;
-                        ws->set_size_request(ws_width, ws_height);
-                        ws->add_css_class("workspace");
-                        if ((workspace_data[i]["workspace"]["x"].as_int() == k) &&
-                            (workspace_data[i]["workspace"]["y"].as_int() == j))
-                        {
-                            ws->add_css_class("active");
-                            this->current_ws_x = k;
-                            this->current_ws_y = j;
-                        } else
-                        {
-                            ws->add_css_class("inactive");
-                        }
-
-                        ws->x_index = k;
-                        ws->y_index = j;
-                        mini_grid.attach(*ws, ws->x_index, ws->y_index, 1, 1);
-
-                        ws = Gtk::make_managed<WayfireWorkspaceBox>(this);
-                        ws->output_id = output_data["id"].as_int();
-                        ws->set_size_request(size.first, size.second);
-                        ws->add_css_class("workspace");
-                        if ((workspace_data[i]["workspace"]["x"].as_int() == k) &&
-                            (workspace_data[i]["workspace"]["y"].as_int() == j))
-                        {
-                            ws->add_css_class("active");
-                            this->current_ws_x = k;
-                            this->current_ws_y = j;
-                        } else
-                        {
-                            ws->add_css_class("inactive");
-                        }
-
-                        ws->x_index = k;
-                        ws->y_index = j;
-                        auto popover_click_gesture = Gtk::GestureClick::create();
-                        popover_click_gesture->set_button(0);
-                        popover_click_gesture->signal_released().connect(sigc::mem_fun(*ws,
-                            &WayfireWorkspaceBox::on_switch_grid_clicked));
-                        ws->add_controller(popover_click_gesture);
-                        switch_grid.attach(*ws, ws->x_index, ws->y_index, 1, 1);
-                        if (workspace_switcher_render_views.value() && (j == this->grid_height - 1) &&
-                            (k == this->grid_width - 1))
-                        {
-                            ipc_client->send("{\"method\":\"window-rules/list-views\"}", [=] (wf::json_t data)
-                            {
-                                if (data.serialize().find("error") != std::string::npos)
-                                {
-                                    std::cerr << data.serialize() << std::endl;
-                                    std::cerr << "Error getting views list for workspace-switcher widget!" <<
-                                        std::endl;
-                                    return;
-                                }
-
-                                grid_render_views(data);
-                            });
-                        }
-                    }
-                }
-            }
-        });
+    w->set_placement(placement);
+    if (ws == w->ws)
+    {
+        // Only moved within the box, reposition without rebuilding
+        ws->queue_allocate();
+        return;
     }
+
+    w->reference();
+    w->ws->remove_overlay(*w);
+    ws->add_overlay(*w);
+    w->unreference();
+    w->ws = ws;
 }
 
-void WayfireWorkspaceSwitcher::add_view(wf::json_t view_data)
+void WayfireWorkspaceSwitcher::grid_add_view(const IPCView& view)
 {
-    if (view_data["type"].as_string() != "toplevel")
+    if (!should_show_view(view) || find_window(view.id))
     {
         return;
     }
 
-    if (view_data["output-name"].as_string() != this->output_name)
+    auto v = create_window(view);
+    v->set_placement(place_view(view));
+    v->ws = (WayfireWorkspaceBox*)&overlay;
+    // add to workspace box
+    overlay.add_overlay(*v);
+    windows[v->id] = v;
+}
+
+void WayfireWorkspaceSwitcher::grid_update_view(const IPCView& view)
+{
+    auto w = find_window(view.id);
+    if (!w)
     {
+        grid_add_view(view);
         return;
     }
 
-    if (view_data["minimized"].as_bool())
+    if (!should_show_view(view))
     {
+        grid_remove_view(view.id);
         return;
     }
 
-    auto v = Gtk::make_managed<WayfireWorkspaceWindow>();
-    v->add_css_class("view");
-    v->add_css_class(view_data["app-id"].as_string());
-    v->id = view_data["id"].as_int();
-    if (view_data["activated"].as_bool() || (v->id == this->active_view_id))
+    // All workspaces share one overlay, so this never needs a new widget
+    w->set_placement(place_view(view));
+    overlay.queue_allocate();
+}
+
+void WayfireWorkspaceSwitcher::remove_view(int view_id)
+{
+    if (auto w = find_window(view_id))
     {
-        v->add_css_class("active");
-        v->active = true;
-        this->active_view_id = v->id;
-    } else
+        windows.erase(view_id);
+        w->ws->remove_overlay(*w);
+    }
+}
+
+void WayfireWorkspaceSwitcher::grid_remove_view(int view_id)
+{
+    if (auto w = find_window(view_id))
     {
-        v->add_css_class("inactive");
-        v->active = false;
+        windows.erase(view_id);
+        overlay.remove_overlay(*w);
     }
+}
 
-    v->output_id = view_data["output-id"].as_int();
-    double x, y, w, h;
-    if (view_data["geometry"]["x"].is_int())
+void WayfireWorkspaceSwitcher::raise_window(WayfireWorkspaceWindow *w)
+{
+    // Overlay children are drawn in order, the last one on top
+    w->reference();
+    w->ws->remove_overlay(*w);
+    w->ws->add_overlay(*w);
+    w->unreference();
+}
+
+void WayfireWorkspaceSwitcher::render_views()
+{
+    // Bottom to top, later windows are drawn over earlier ones
+    for (int id : ipc_state->get_view_order())
     {
-        x = view_data["geometry"]["x"].as_int();
-        y = view_data["geometry"]["y"].as_int();
-        w = view_data["geometry"]["width"].as_int();
-        h = view_data["geometry"]["height"].as_int();
-    } else
+        add_view(*ipc_state->get_view(id));
+    }
+
+    if (auto w = find_window(active_view_id))
     {
-        x = view_data["geometry"]["x"].as_double();
-        y = view_data["geometry"]["y"].as_double();
-        w = view_data["geometry"]["width"].as_double();
-        h = view_data["geometry"]["height"].as_double();
+        raise_window(w);
     }
+}
 
-    for (auto widget : box.get_children())
+void WayfireWorkspaceSwitcher::grid_render_views()
+{
+    for (int id : ipc_state->get_view_order())
     {
-        WayfireWorkspaceBox *ws = (WayfireWorkspaceBox*)widget;
-        for (auto child : widget->get_children())
-        {
-            WayfireWorkspaceWindow *window = (WayfireWorkspaceWindow*)child;
-            if (window->id == v->id)
-            {
-                return;
-            }
-        }
+        grid_add_view(*ipc_state->get_view(id));
+    }
 
-        auto size     = ws->get_scaled_size();
-        double width  = size.first;
-        double height = size.second;
-
-        v->x = x * (width / float(ws->output_width));
-        v->y = y * (height / float(ws->output_height));
-        v->w = (w / float(ws->output_width)) * width;
-        v->h = (h / float(ws->output_height)) * height;
-        std::pair<int, int> workspace;
-        workspace  = get_workspace(ws, v);
-        v->x_index = workspace.first;
-        v->y_index = workspace.second;
-        if ((v->x_index == ws->x_index) && (v->y_index == ws->y_index))
-        {
-            v->ws = ws;
-            v->set_can_target(false);
-            // add to workspace box
-            ws->add_overlay(*v);
-            windows.push_back(v);
-
-            return;
-        }
+    if (auto w = find_window(active_view_id))
+    {
+        raise_window(w);
     }
 }
 
-void WayfireWorkspaceSwitcher::grid_add_view(wf::json_t view_data)
+void WayfireWorkspaceSwitcher::on_view_changed(const IPCView& view)
 {
-    if (view_data["type"].as_string() != "toplevel")
+    // Only record what changed, the widgets are updated once per frame
+    pending.removed_views.erase(view.id);
+    pending.views[view.id] = view;
+
+    int focused = pending.focus_changed ? pending.focused_view : active_view_id;
+    if (view.activated && view.is_toplevel() && (view.id != focused))
     {
-        return;
+        pending.focused_view  = view.id;
+        pending.focus_changed = true;
+    } else if (!view.activated && (view.id == focused))
+    {
+        pending.focused_view  = -1;
+        pending.focus_changed = true;
     }
 
-    if (view_data["output-name"].as_string() != this->output_name)
+    schedule_changes();
+}
+
+void WayfireWorkspaceSwitcher::on_view_removed(int view_id)
+{
+    pending.views.erase(view_id);
+    pending.removed_views.insert(view_id);
+    schedule_changes();
+}
+
+void WayfireWorkspaceSwitcher::on_wset_changed(const IPCWset& wset)
+{
+    if ((wset.index != ipc_wset_index) ||
+        (wset.workspace_x < 0) || (wset.workspace_x >= grid_width) ||
+        (wset.workspace_y < 0) || (wset.workspace_y >= grid_height))
     {
-        return;
+        // Another wset is shown on this output now, or the grid was resized
+        pending.refresh = true;
+    } else
+    {
+        pending.workspace_x = wset.workspace_x;
+        pending.workspace_y = wset.workspace_y;
+    }
+
+    schedule_changes();
+}
+
+void WayfireWorkspaceSwitcher::queue_rebuild()
+{
+    pending.refresh = true;
+    schedule_changes();
+}
+
+void WayfireWorkspaceSwitcher::schedule_changes()
+{
+    if (!tick_callback_id)
+    {
+        tick_callback_id = switcher_box.add_tick_callback(
+            sigc::mem_fun(*this, &WayfireWorkspaceSwitcher::on_frame_tick));
     }
+}
+
+bool WayfireWorkspaceSwitcher::on_frame_tick(const Glib::RefPtr<Gdk::FrameClock>& clock)
+{
+    tick_callback_id = 0;
+    apply_pending_changes();
+    update_thumbnails();
+    return false;
+}
+
+void WayfireWorkspaceSwitcher::apply_pending_changes()
+{
+    auto changes = std::move(pending);
+    pending = {};
 
-    if (view_data["minimized"].as_bool())
+    if (changes.refresh)
     {
+        // Recreates everything, including the views
+        rebuild();
         return;
     }
 
-    auto v = Gtk::make_managed<WayfireWorkspaceWindow>();
-    v->add_css_class("view");
-    v->add_css_class(view_data["app-id"].as_string());
-    v->id = view_data["id"].as_int();
-    if (view_data["activated"].as_bool() || (v->id == this->active_view_id))
+    // Applied first, the view geometry in later events is relative to it
+    if (changes.workspace_x >= 0)
     {
-        v->add_css_class("active");
-        v->active = true;
-        this->active_view_id = v->id;
-    } else
+        ipc_ws_x = changes.workspace_x;
+        ipc_ws_y = changes.workspace_y;
+    }
+
+    auto shown = get_shown_workspace();
+    if ((ipc_output_id >= 0) && ((shown.first != current_ws_x) || (shown.second != current_ws_y)) &&
+        !set_current_workspace(shown.first, shown.second))
     {
-        v->add_css_class("inactive");
-        v->active = false;
+        rebuild();
+        return;
     }
 
-    v->output_id = view_data["output-id"].as_int();
-    double x, y, w, h;
-    if (view_data["geometry"]["x"].is_int())
+    if (use_minimap())
     {
-        x = view_data["geometry"]["x"].as_int();
-        y = view_data["geometry"]["y"].as_int();
-        w = view_data["geometry"]["width"].as_int();
-        h = view_data["geometry"]["height"].as_int();
-    } else
+        minimap_apply_changes(changes);
+        return;
+    }
+
+    bool row = (layout.value() == "row");
+    for (int id : changes.removed_views)
     {
-        x = view_data["geometry"]["x"].as_double();
-        y = view_data["geometry"]["y"].as_double();
-        w = view_data["geometry"]["width"].as_double();
-        h = view_data["geometry"]["height"].as_double();
+        if (row)
+        {
+            remove_view(id);
+        } else
+        {
+            grid_remove_view(id);
+        }
     }
 
-    for (auto widget : overlay.get_children())
+    for (auto& [_, view] : changes.views)
     {
-        WayfireWorkspaceWindow *window = (WayfireWorkspaceWindow*)widget;
-        if (window->id == v->id)
+        if (row)
         {
-            return;
+            update_view(view);
+        } else
+        {
+            grid_update_view(view);
         }
+    }
+
+    if (changes.focus_changed)
+    {
+        set_focused_view(changes.focused_view);
+    }
+}
 
-        auto size     = this->get_scaled_size();
-        double width  = size.first;
-        double height = size.second;
-
-        v->x = x * (width / float(this->output_width));
-        v->y = y * (height / float(this->output_height));
-        v->w = (w / float(this->output_width)) * width;
-        v->h = (h / float(this->output_height)) * height;
-        std::pair<int, int> workspace;
-        workspace  = grid_get_workspace(v);
-        v->x_index = workspace.first;
-        v->y_index = workspace.second;
-        WayfireWorkspaceBox *ws = (WayfireWorkspaceBox*)&overlay;
-        v->ws = ws;
-        v->set_can_target(false);
-        // add to workspace box
-        overlay.add_overlay(*v);
-        windows.push_back(v);
+void WayfireWorkspaceSwitcher::set_focused_view(int view_id)
+{
+    // Only the previously and the newly focused window change
+    if (auto old_window = find_window(active_view_id))
+    {
+        old_window->remove_css_class("active");
+        old_window->add_css_class("inactive");
+        old_window->active = false;
+    }
 
-        return;
+    this->active_view_id = view_id;
+    if (auto w = find_window(view_id))
+    {
+        w->remove_css_class("inactive");
+        w->add_css_class("active");
+        w->active = true;
+        raise_window(w);
     }
 }
 
-void WayfireWorkspaceSwitcher::remove_view(wf::json_t view_data)
+bool WayfireWorkspaceSwitcher::use_minimap()
 {
-    for (auto w : this->windows)
+    return render_mode.value() == "minimap";
+}
+
+void WayfireWorkspaceSwitcher::detach_minimap()
+{
+    if (!button)
     {
-        if (w->id == view_data["id"].as_int())
-        {
-            for (auto widget : box.get_children())
-            {
-                WayfireWorkspaceBox *ws = (WayfireWorkspaceBox*)widget;
-                if (w->get_parent() == ws)
-                {
-                    ws->remove_overlay(*w);
-                    auto elem = std::remove(windows.begin(), windows.end(), w);
-                    windows.erase(elem, windows.end());
-                    return;
-                }
-            }
-        }
+        return;
+    }
+
+    if (button->get_popup_child() == &minimap)
+    {
+        button->get_scroll().unset_child();
+    }
+
+    if (mini_minimap.get_parent())
+    {
+        button->remove(mini_minimap);
     }
 }
 
-void WayfireWorkspaceSwitcher::grid_remove_view(wf::json_t view_data)
+void WayfireWorkspaceSwitcher::minimap_process(const IPCWset& wset)
 {
-    for (auto w : this->windows)
+    clear_box();
+    this->current_ws_x = wset.workspace_x;
+    this->current_ws_y = wset.workspace_y;
+
+    minimap_model.output_id     = ipc_output_id;
+    minimap_model.grid_width    = this->grid_width;
+    minimap_model.grid_height   = this->grid_height;
+    minimap_model.current_x     = this->current_ws_x;
+    minimap_model.current_y     = this->current_ws_y;
+    minimap_model.output_width  = this->output_width;
+    minimap_model.output_height = this->output_height;
+    minimap_model.views.clear();
+    update_minimap_size();
+}
+
+void WayfireWorkspaceSwitcher::minimap_render_views()
+{
+    minimap_model.view_order = ipc_state->get_view_order();
+    for (auto& [_, view] : ipc_state->get_views())
     {
-        if (w->id == view_data["id"].as_int())
+        if (!should_show_view(view))
+        {
+            continue;
+        }
+
+        if (view.activated)
         {
-            overlay.remove_overlay(*w);
-            auto elem = std::remove(windows.begin(), windows.end(), w);
-            windows.erase(elem, windows.end());
-            return;
+            minimap_model.active_view_id = active_view_id = view.id;
         }
+
+        minimap_set_view(view);
     }
+
+    minimap.queue_draw();
+    mini_minimap.queue_draw();
 }
 
-void WayfireWorkspaceSwitcher::render_views(wf::json_t views_data)
+void WayfireWorkspaceSwitcher::minimap_apply_changes(const pending_changes_t& changes)
 {
-    for (size_t i = 0; i < views_data.size(); i++)
+    // Only the model changes, everything is drawn again in one go
+    bool render_views = workspace_switcher_render_views.value();
+    for (int id : changes.removed_views)
     {
-        add_view(views_data[i]);
+        minimap_model.views.erase(id);
     }
 
-    for (auto w : windows)
+    for (auto& [id, view] : changes.views)
     {
-        if (w->active)
+        if (render_views && should_show_view(view))
         {
-            w->reference();
-            w->ws->remove_overlay(*w);
-            w->ws->add_overlay(*w);
-            w->unreference();
-            w->add_css_class("active");
+            minimap_set_view(view);
+        } else
+        {
+            minimap_model.views.erase(id);
         }
     }
+
+    if (changes.focus_changed)
+    {
+        minimap_model.active_view_id = active_view_id = changes.focused_view;
+    }
+
+    // Mapped and focused views change it, the state is up to date by now
+    minimap_model.view_order = ipc_state->get_view_order();
+    minimap.queue_draw();
+    mini_minimap.queue_draw();
+}
+
+void WayfireWorkspaceSwitcher::minimap_set_view(const IPCView& view)
+{
+    // Stored relative to the grid, so that nothing moves on workspace changes
+    auto& stored = minimap_model.views[view.id] = view;
+    stored.geometry.x += ipc_ws_x * minimap_model.output_width;
+    stored.geometry.y += ipc_ws_y * minimap_model.output_height;
 }
 
-void WayfireWorkspaceSwitcher::grid_render_views(wf::json_t views_data)
+void WayfireWorkspaceSwitcher::update_minimap_size()
 {
-    for (size_t i = 0; i < views_data.size(); i++)
+    if (!use_minimap())
     {
-        grid_add_view(views_data[i]);
+        return;
     }
 
-    for (auto w : windows)
+    auto size = get_scaled_size();
+    minimap.set_cell_size(size.first, size.second);
+    mini_minimap.set_cell_size(size.first / minimap_model.grid_width,
+        size.second / minimap_model.grid_height);
+    minimap.queue_draw();
+    mini_minimap.queue_draw();
+}
+
+void WayfireWorkspaceSwitcher::switch_to_workspace(int x, int y)
+{
+    if (ipc_output_id < 0)
     {
-        if (w->gobj() == GTK_WIDGET(switch_grid.gobj()))
-        {
-            continue;
-        }
+        return;
+    }
 
-        if (w->active)
-        {
-            w->reference();
-            w->ws->remove_overlay(*w);
-            w->ws->add_overlay(*w);
-            w->unreference();
-            w->add_css_class("active");
-        }
+    wf::json_t workspace_switch_request;
+    workspace_switch_request["method"] = "vswitch/set-workspace";
+    wf::json_t workspace;
+    workspace["x"] = x;
+    workspace["y"] = y;
+    workspace["output-id"] = ipc_output_id;
+    workspace_switch_request["data"] = workspace;
+
+    uint64_t serial = next_switch_serial++;
+    uint64_t token  = ipc_client->send_interactive(workspace_switch_request.serialize(),
+        [=] (wf::json_t data) { on_switch_reply(serial, data); }, WORKSPACE_SWITCH_TIMEOUT_MS);
+    if (!token)
+    {
+        return;
     }
+
+    // Shown with the next frame instead of after the round trip to Wayfire
+    optimistic_switches.push_back({serial, x, y});
+    schedule_changes();
 }
 
-void WayfireWorkspaceSwitcher::on_event(wf::json_t data)
+void WayfireWorkspaceSwitcher::on_switch_reply(uint64_t serial, const wf::json_t& data)
 {
-    if (layout.value() == "row")
+    if (data.has_member("error"))
     {
-        switcher_on_event(data);
-    } else // "grid"/"grid_popover"
+        std::cerr << data.serialize() << std::endl;
+        std::cerr << "Error switching workspaces. Is vswitch plugin enabled?" << std::endl;
+    }
+
+    // Wayfire sends the workspace change event before the reply, so from now
+    // on its own state shows the result. After an error, this rolls back to
+    // the workspace of a later switch or the one Wayfire is on.
+    auto it = std::find_if(optimistic_switches.begin(), optimistic_switches.end(),
+        [=] (const optimistic_switch_t& sw) { return sw.serial == serial; });
+    if (it != optimistic_switches.end())
     {
-        grid_on_event(data);
+        optimistic_switches.erase(it);
+        schedule_changes();
     }
 }
 
-void WayfireWorkspaceSwitcher::switcher_on_event(wf::json_t data)
+std::pair<int, int> WayfireWorkspaceSwitcher::get_shown_workspace()
 {
-    if (data["event"].as_string() == "view-geometry-changed")
+    if (!optimistic_switches.empty())
     {
-        for (auto child : box.get_children())
-        {
-            WayfireWorkspaceBox *ws = (WayfireWorkspaceBox*)child;
-            for (auto widget : child->get_children())
-            {
-                WayfireWorkspaceWindow *w = (WayfireWorkspaceWindow*)widget;
-                if (w->id == data["view"]["id"].as_int())
-                {
-                    ws->remove_overlay(*w);
-                    auto elem = std::remove(windows.begin(), windows.end(), w);
-                    windows.erase(elem, windows.end());
-                }
-            }
-        }
+        return {optimistic_switches.back().x, optimistic_switches.back().y};
+    }
 
-        add_view(data["view"]);
-    } else if (data["event"].as_string() == "view-mapped")
+    return {ipc_ws_x, ipc_ws_y};
+}
+
+void WayfireWorkspaceSwitcher::on_minimap_scrolled(int direction)
+{
+    int y = std::clamp(minimap_model.current_y + direction, 0, minimap_model.grid_height - 1);
+    if (y != minimap_model.current_y)
     {
-        add_view(data["view"]);
-    } else if ((data["event"].as_string() == "view-focused") && data["view"].is_object())
+        switch_to_workspace(minimap_model.current_x, y);
+    }
+}
+
+void WayfireWorkspaceSwitcher::update_thumbnails()
+{
+    if (!thumbnails || !thumbnails->is_available())
+    {
+        return;
+    }
+
+    // Views on the current workspace are refreshed first, the focused one before all
+    auto size     = get_scaled_size();
+    int scale     = switcher_box.get_scale_factor();
+    auto priority = [=] (int view_id, int x_index, int y_index)
     {
-        if (data["view"]["type"].as_string() != "toplevel")
+        if (view_id == active_view_id)
         {
-            return;
+            return 2;
         }
 
-        for (auto child : box.get_children())
+        return ((x_index == current_ws_x) && (y_index == current_ws_y)) ? 1 : 0;
+    };
+
+    std::unordered_set<int> shown;
+    if (use_minimap())
+    {
+        double scale_x = size.first / minimap_model.output_width;
+        double scale_y = size.second / minimap_model.output_height;
+        for (auto& [id, view] : minimap_model.views)
         {
-            for (auto widget : child->get_children())
+            auto& g = view.geometry;
+            int x_index = std::floor((g.x + g.width / 2.0) / minimap_model.output_width);
+            int y_index = std::floor((g.y + g.height / 2.0) / minimap_model.output_height);
+            thumbnails->request(id, priority(id, x_index, y_index),
+                std::ceil(g.width * scale_x * scale), std::ceil(g.height * scale_y * scale));
+            if (auto texture = thumbnails->get(id))
             {
-                WayfireWorkspaceWindow *w = (WayfireWorkspaceWindow*)widget;
-                if (w->id == data["view"]["id"].as_int())
-                {
-                    w->remove_css_class("inactive");
-                    w->add_css_class("active");
-                    w->active = true;
-                    this->active_view_id = w->id;
-                } else
-                {
-                    w->remove_css_class("active");
-                    w->add_css_class("inactive");
-                    w->active = false;
-                }
+                minimap_model.thumbnails[id] = texture;
             }
-        }
 
-        for (auto w : windows)
+            shown.insert(id);
+        }
+    } else
+    {
+        for (auto& [id, w] : windows)
         {
-            if (w->active)
+            thumbnails->request(id, priority(id, w->x_index, w->y_index), w->w * scale, w->h * scale);
+            if (!w->thumbnail)
             {
-                w->reference();
-                w->ws->remove_overlay(*w);
-                w->ws->add_overlay(*w);
-                w->unreference();
-                w->add_css_class("active");
-                this->active_view_id = w->id;
+                w->set_thumbnail(thumbnails->get(id));
             }
+
+            shown.insert(id);
         }
-    } else if (data["event"].as_string() == "view-unmapped")
-    {
-        remove_view(data["view"]);
-    } else if (data["event"].as_string() == "view-set-output")
-    {
-        add_view(data["view"]);
-    } else if ((data["event"].as_string() == "output-layout-changed") ||
-               (data["event"].as_string() == "wset-workspace-changed") ||
-               (data["event"].as_string() == "view-minimized"))
+    }
+
+    for (int id : thumbnail_views)
     {
-        get_wsets();
+        if (!shown.count(id))
+        {
+            thumbnails->release(id);
+            minimap_model.thumbnails.erase(id);
+        }
     }
+
+    thumbnail_views = std::move(shown);
 }
 
-void WayfireWorkspaceSwitcher::grid_on_event(wf::json_t data)
+void WayfireWorkspaceSwitcher::release_thumbnails()
 {
-    if (data["event"].as_string() == "view-geometry-changed")
+    thumbnail_signal.disconnect();
+    if (thumbnails)
     {
-        for (auto widget : overlay.get_children())
+        for (int id : thumbnail_views)
         {
-            WayfireWorkspaceWindow *w = (WayfireWorkspaceWindow*)widget;
-            if (w->id == data["view"]["id"].as_int())
-            {
-                overlay.remove_overlay(*w);
-                auto elem = std::remove(windows.begin(), windows.end(), w);
-                windows.erase(elem, windows.end());
-            }
+            thumbnails->release(id);
         }
+    }
+
+    for (auto& [_, w] : windows)
+    {
+        w->set_thumbnail({});
+    }
+
+    thumbnail_views.clear();
+    minimap_model.thumbnails.clear();
+    thumbnails = nullptr;
+    minimap.queue_draw();
+    mini_minimap.queue_draw();
+}
+
+void WayfireWorkspaceSwitcher::on_thumbnail_updated(int view_id)
+{
+    if (!thumbnail_views.count(view_id))
+    {
+        return;
+    }
 
-        grid_add_view(data["view"]);
-    } else if (data["event"].as_string() == "view-mapped")
+    auto texture = thumbnails->get(view_id);
+    if (use_minimap())
     {
-        grid_add_view(data["view"]);
-    } else if ((data["event"].as_string() == "view-focused") && data["view"].is_object())
+        minimap_model.thumbnails[view_id] = texture;
+        minimap.queue_draw();
+        mini_minimap.queue_draw();
+    } else if (auto w = find_window(view_id))
+    {
+        w->set_thumbnail(texture);
+    }
+}
+
+static void set_workspace_box_active(Gtk::Widget *ws, bool active)
+{
+    ws->remove_css_class(active ? "inactive" : "active");
+    ws->add_css_class(active ? "active" : "inactive");
+}
+
+bool WayfireWorkspaceSwitcher::set_current_workspace(int x, int y)
+{
+    this->current_ws_x = x;
+    this->current_ws_y = y;
+
+    if (use_minimap())
+    {
+        minimap_model.current_x = x;
+        minimap_model.current_y = y;
+        minimap.queue_draw();
+        mini_minimap.queue_draw();
+        return true;
+    }
+
+    if (layout.value() == "row")
     {
-        if (data["view"]["type"].as_string() != "toplevel")
+        // The boxes show another row now, with other windows
+        if (y != rendered_row)
         {
-            return;
+            return false;
         }
 
-        for (auto widget : overlay.get_children())
+        for (auto widget : box.get_children())
         {
-            if (widget->gobj() == GTK_WIDGET(switch_grid.gobj()))
-            {
-                continue;
-            }
-
-            WayfireWorkspaceWindow *w = (WayfireWorkspaceWindow*)widget;
-            if (w->id == data["view"]["id"].as_int())
-            {
-                w->remove_css_class("inactive");
-                w->add_css_class("active");
-                w->active = true;
-                this->active_view_id = w->id;
-            } else
-            {
-                w->remove_css_class("active");
-                w->add_css_class("inactive");
-                w->active = false;
-            }
+            auto ws = (WayfireWorkspaceBox*)widget;
+            set_workspace_box_active(ws, ws->x_index == x);
         }
 
-        for (auto w : windows)
-        {
-            if (w->gobj() == GTK_WIDGET(switch_grid.gobj()))
-            {
-                continue;
-            }
+        return true;
+    }
 
-            if (w->active)
-            {
-                w->reference();
-                w->ws->remove_overlay(*w);
-                w->ws->add_overlay(*w);
-                w->unreference();
-                w->add_css_class("active");
-                this->active_view_id = w->id;
-            }
-        }
-    } else if (data["event"].as_string() == "view-unmapped")
-    {
-        grid_remove_view(data["view"]);
-    } else if (data["event"].as_string() == "view-set-output")
-    {
-        grid_add_view(data["view"]);
-    } else if ((data["event"].as_string() == "output-layout-changed") ||
-               (data["event"].as_string() == "wset-workspace-changed") ||
-               (data["event"].as_string() == "view-minimized"))
+    // The windows are placed relative to their workspace and stay where they are
+    for (auto grid : {&mini_grid, &switch_grid})
     {
-        get_wsets();
+        for (auto widget : grid->get_children())
+        {
+            auto ws = (WayfireWorkspaceBox*)widget;
+            set_workspace_box_active(ws, (ws->x_index == x) && (ws->y_index == y));
+        }
     }
+
+    return true;
 }
 
 WayfireWorkspaceSwitcher::WayfireWorkspaceSwitcher(WayfireOutput *output)
@@ -1003,14 +1200,28 @@ WayfireWorkspaceSwitcher::WayfireWorkspaceSwitcher(WayfireOutput *output)
     this->output_name = output->monitor->get_connector();
     switcher_box.set_halign(Gtk::Align::CENTER);
     switcher_box.set_valign(Gtk::Align::CENTER);
+    minimap.signal_workspace_clicked().connect(
+        sigc::mem_fun(*this, &WayfireWorkspaceSwitcher::switch_to_workspace));
+    minimap.signal_scrolled().connect(sigc::mem_fun(*this, &WayfireWorkspaceSwitcher::on_minimap_scrolled));
+    // Clicks go to the button, which opens the popover
+    mini_minimap.set_can_target(false);
 }
 
 WayfireWorkspaceSwitcher::~WayfireWorkspaceSwitcher()
 {
-    if (ipc_client)
+    for (auto& signal : state_signals)
+    {
+        signal.disconnect();
+    }
+
+    state_watches.clear();
+    if (tick_callback_id)
     {
-        ipc_client->unsubscribe(this);
+        switcher_box.remove_tick_callback(tick_callback_id);
     }
 
+    release_thumbnails();
+    clear_switcher_box();
+    detach_minimap();
     clear_box();
 }
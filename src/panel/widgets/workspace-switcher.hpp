@@ -1,12 +1,27 @@
 #pragma once
 
+#include <deque>
 #include <gtkmm.h>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "../widget.hpp"
 #include "wf-popover.hpp"
 #include "wf-ipc.hpp"
+#include "wf-ipc-state.hpp"
+#include "workspace-minimap.hpp"
+#include "workspace-thumbnails.hpp"
 
 class WayfireWorkspaceBox;
+
+/* A view scaled down to the switcher, relative to the workspace it is shown on */
+struct WayfireWorkspaceWindowPlacement
+{
+    int x, y, w, h;
+    /* The workspace the center of the view is on */
+    int x_index, y_index;
+};
+
 class WayfireWorkspaceWindow : public Gtk::Widget
 {
   public:
@@ -15,34 +30,120 @@ class WayfireWorkspaceWindow : public Gtk::Widget
     int id, output_id;
     bool active;
     WayfireWorkspaceBox *ws;
+    /* Drawn over the CSS background when live thumbnails are enabled */
+    Glib::RefPtr<Gdk::Texture> thumbnail;
+    void set_placement(const WayfireWorkspaceWindowPlacement& placement);
+    void set_thumbnail(const Glib::RefPtr<Gdk::Texture>& texture);
     WayfireWorkspaceWindow()
     {}
     ~WayfireWorkspaceWindow() override
     {}
+
+  protected:
+    void snapshot_vfunc(const Glib::RefPtr<Gtk::Snapshot>& snapshot) override;
 };
 
-class WayfireWorkspaceSwitcher : public WayfireWidget, public IIPCSubscriber
+class WayfireWorkspaceSwitcher : public WayfireWidget
 {
     std::string output_name;
     void set_size();
-    void on_event(wf::json_t data) override;
-    void switcher_on_event(wf::json_t data);
-    void grid_on_event(wf::json_t data);
-    void render_workspace(wf::json_t workspace_data, int j, int output_id, int output_width,
-        int output_height);
-    void process_workspaces(wf::json_t workspace_data);
-    void grid_process_workspaces(wf::json_t workspace_data);
-    void render_views(wf::json_t views_data);
-    void grid_render_views(wf::json_t views_data);
-    void add_view(wf::json_t view_data);
-    void grid_add_view(wf::json_t view_data);
-    void remove_view(wf::json_t view_data);
-    void grid_remove_view(wf::json_t view_data);
+
+    /* Changes on this output from the shared state */
+    std::shared_ptr<WayfireIPCState> ipc_state;
+    std::vector<sigc::connection> state_signals;
+    std::vector<std::unique_ptr<IPCStateWatch>> state_watches;
+    void on_view_changed(const IPCView& view);
+    void on_view_removed(int view_id);
+    void on_wset_changed(const IPCWset& wset);
+    void queue_rebuild();
+
+    /* Changes from the shared state, applied to the widgets once per frame */
+    struct pending_changes_t
+    {
+        std::unordered_map<int, IPCView> views;
+        std::unordered_set<int> removed_views;
+        /* The newly focused view, -1 if none of this output */
+        int focused_view   = -1;
+        bool focus_changed = false;
+        /* The new current workspace, -1 if unchanged */
+        int workspace_x = -1, workspace_y = -1;
+        bool refresh    = false;
+    };
+    pending_changes_t pending;
+    guint tick_callback_id = 0;
+    void schedule_changes();
+    bool on_frame_tick(const Glib::RefPtr<Gdk::FrameClock>& clock);
+    void apply_pending_changes();
+    void set_focused_view(int view_id);
+    /* Update the workspace boxes in place, false if they need to be rebuilt */
+    bool set_current_workspace(int x, int y);
+    /* The output and wset shown, as known to Wayfire */
+    int ipc_output_id  = -1;
+    int ipc_wset_index = -1;
+    /* The current workspace as known to Wayfire, view geometry is relative to it */
+    int ipc_ws_x = 0, ipc_ws_y = 0;
+    /**
+     * Workspace switches sent to Wayfire and already shown, oldest first.
+     * Each is dropped with its reply, which falls back to the workspace of
+     * a later switch or the one Wayfire is on.
+     */
+    struct optimistic_switch_t
+    {
+        uint64_t serial;
+        int x, y;
+    };
+    std::deque<optimistic_switch_t> optimistic_switches;
+    uint64_t next_switch_serial = 1;
+    void on_switch_reply(uint64_t serial, const wf::json_t& data);
+    /* The workspace of the last switch, or Wayfire's one if there is none */
+    std::pair<int, int> get_shown_workspace();
+    /* The row whose windows are shown in the "row" layout */
+    int rendered_row = -1;
+    void render_workspace(const IPCWset& wset, int j);
+    void process_workspaces(const IPCWset& wset);
+    void grid_process_workspaces(const IPCWset& wset);
+    void render_views();
+    void grid_render_views();
+    WayfireWorkspaceWindowPlacement place_view(const IPCView& view);
+    bool should_show_view(const IPCView& view);
+    WayfireWorkspaceWindow *find_window(int view_id);
+    WayfireWorkspaceBox *find_box(int x_index, int y_index);
+    WayfireWorkspaceWindow *create_window(const IPCView& view);
+    void add_view(const IPCView& view);
+    void grid_add_view(const IPCView& view);
+    /* Move an existing window widget instead of recreating it */
+    void update_view(const IPCView& view);
+    void grid_update_view(const IPCView& view);
+    void remove_view(int view_id);
+    void grid_remove_view(int view_id);
+    void raise_window(WayfireWorkspaceWindow *w);
     void clear_switcher_box();
     void clear_box();
-    void get_wsets();
+    /* Recreate the workspaces and windows from the shared state */
+    void rebuild();
     bool on_get_child_position(Gtk::Widget *widget, Gdk::Rectangle& allocation);
+    bool use_minimap();
+    void detach_minimap();
+    void minimap_process(const IPCWset& wset);
+    void minimap_render_views();
+    void minimap_apply_changes(const pending_changes_t& changes);
+    void minimap_set_view(const IPCView& view);
+    void update_minimap_size();
+    void on_minimap_scrolled(int direction);
+    /* Live thumbnails of the shown views, shared with the other outputs */
+    std::shared_ptr<WayfireWorkspaceThumbnails> thumbnails;
+    sigc::connection thumbnail_signal;
+    std::unordered_set<int> thumbnail_views;
+    void update_thumbnails();
+    void release_thumbnails();
+    void on_thumbnail_updated(int view_id);
     bool on_grid_get_child_position(Gtk::Widget *widget, Gdk::Rectangle& allocation);
+    sigc::connection grid_position_signal;
+
+    /* Window widgets created since the last log, to verify they are reused */
+    uint64_t window_widgets_created = 0;
+    int64_t creation_log_since      = 0;
+    void log_window_created();
 
   public:
     Gtk::Box box;
@@ -56,17 +157,26 @@ class WayfireWorkspaceSwitcher : public WayfireWidget, public IIPCSubscriber
     void init(Gtk::Box *container) override;
     WayfireWorkspaceSwitcher(WayfireOutput *output);
     ~WayfireWorkspaceSwitcher();
-    int grid_width, grid_height;
-    int active_view_id;
+    int grid_width = 1, grid_height = 1;
+    int active_view_id = -1;
     std::shared_ptr<IPCClient> ipc_client;
-    std::pair<int, int> get_workspace(WayfireWorkspaceBox *ws, WayfireWorkspaceWindow *w);
-    std::pair<int, int> grid_get_workspace(WayfireWorkspaceWindow *w);
-    int current_ws_x, current_ws_y;
-    std::vector<WayfireWorkspaceWindow*> windows;
+    /* The workspace shown as current */
+    int current_ws_x = 0, current_ws_y = 0;
+    /* Show the workspace right away and ask Wayfire to switch to it */
+    void switch_to_workspace(int x, int y);
+    /* Window widgets by view id */
+    std::unordered_map<int, WayfireWorkspaceWindow*> windows;
     WfOption<std::string> layout{"panel/workspace_switcher_layout"};
     WfOption<double> workspace_switcher_target_size_opt{"panel/workspace_switcher_target_size"};
     double workspace_switcher_target_size;
     WfOption<bool> workspace_switcher_render_views{"panel/workspace_switcher_render_views"};
+    WfOption<std::string> render_mode{"panel/workspace_switcher_render_mode"};
+    WfOption<bool> workspace_switcher_thumbnails{"panel/workspace_switcher_thumbnails"};
+    /* Used instead of the workspace and window widgets in "minimap" render mode */
+    WorkspaceMinimapModel minimap_model;
+    WayfireWorkspaceMinimap minimap{minimap_model};
+    /* The button of the grid_popover layout */
+    WayfireWorkspaceMinimap mini_minimap{minimap_model};
 };
 
 class WayfireWorkspaceBox : public Gtk::Overlay
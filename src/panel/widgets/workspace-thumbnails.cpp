@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <iostream>
+
+#include <wayfire/nonstd/json.hpp>
+#include <wayfire/util/log.hpp>
+
+#include "workspace-thumbnails.hpp"
+
+WayfireWorkspaceThumbnails::WayfireWorkspaceThumbnails()
+{
+    context = ToplevelCaptureContext::get_instance();
+    if (!is_available())
+    {
+        std::cerr << "Workspace switcher thumbnails cannot be enabled." << std::endl;
+        return;
+    }
+
+    logged_at = g_get_monotonic_time();
+    toplevel_done_signal = context->signal_toplevel_done().connect(
+        sigc::mem_fun(*this, &WayfireWorkspaceThumbnails::handle_toplevel_done));
+}
+
+WayfireWorkspaceThumbnails::~WayfireWorkspaceThumbnails()
+{
+    toplevel_done_signal.disconnect();
+    for (auto& [_, thumbnail] : thumbnails)
+    {
+        stop_capture(thumbnail);
+    }
+}
+
+std::shared_ptr<WayfireWorkspaceThumbnails> WayfireWorkspaceThumbnails::get_instance()
+{
+    auto thumbnails = instance.lock();
+    if (!thumbnails)
+    {
+        thumbnails = std::make_shared<WayfireWorkspaceThumbnails>();
+        instance   = thumbnails;
+    }
+
+    return thumbnails;
+}
+
+std::shared_ptr<WayfireWorkspaceThumbnails> WayfireWorkspaceThumbnails::find_instance()
+{
+    return instance.lock();
+}
+
+bool WayfireWorkspaceThumbnails::is_available() const
+{
+    return context->is_available();
+}
+
+void WayfireWorkspaceThumbnails::request(int view_id, int priority, int width, int height)
+{
+    auto& thumbnail = thumbnails[view_id];
+    thumbnail.priority = priority;
+    thumbnail.width    = std::max(width, 1);
+    thumbnail.height   = std::max(height, 1);
+    if (thumbnail.capture)
+    {
+        // Applies from the next frame on
+        thumbnail.capture->priority = priority;
+        thumbnail.capture->max_texture_width = thumbnail.width;
+    }
+
+    start_capture(view_id, thumbnail);
+}
+
+void WayfireWorkspaceThumbnails::release(int view_id)
+{
+    auto it = thumbnails.find(view_id);
+    if (it == thumbnails.end())
+    {
+        return;
+    }
+
+    stop_capture(it->second);
+    thumbnails.erase(it);
+}
+
+Glib::RefPtr<Gdk::Texture> WayfireWorkspaceThumbnails::get(int view_id) const
+{
+    auto it = thumbnails.find(view_id);
+    return (it == thumbnails.end()) ? Glib::RefPtr<Gdk::Texture>{} : it->second.texture;
+}
+
+void WayfireWorkspaceThumbnails::start_capture(int view_id, WorkspaceThumbnail& thumbnail)
+{
+    if (thumbnail.capture && thumbnail.capture->recording_session)
+    {
+        return;
+    }
+
+    auto handle = context->find_toplevel(view_id);
+    if (!is_available() || !handle)
+    {
+        // Started once the toplevel is known
+        return;
+    }
+
+    // A stopped capture is replaced, its last frame is shown until the next one
+    stop_capture(thumbnail);
+    thumbnail.capture = std::make_unique<ToplevelCapture>(handle);
+    thumbnail.capture->priority = thumbnail.priority;
+    thumbnail.capture->max_texture_width = thumbnail.width;
+    thumbnail.frame_signal = thumbnail.capture->signal_frame().connect([=] (int64_t, bool)
+    {
+        handle_frame(view_id);
+    });
+}
+
+void WayfireWorkspaceThumbnails::stop_capture(WorkspaceThumbnail& thumbnail)
+{
+    if (!thumbnail.capture)
+    {
+        return;
+    }
+
+    thumbnail.frame_signal.disconnect();
+    released_stats.add(thumbnail.capture->get_stats());
+    thumbnail.capture.reset();
+}
+
+void WayfireWorkspaceThumbnails::handle_toplevel_done(ext_foreign_toplevel_handle_v1 *handle)
+{
+    auto& app_id = context->toplevels[handle]->app_id;
+    auto view_id = ToplevelCaptureContext::get_view_id_from_full_app_id(app_id);
+    auto it = thumbnails.find(view_id);
+    if ((view_id != 0) && (it != thumbnails.end()))
+    {
+        start_capture(view_id, it->second);
+    }
+}
+
+void WayfireWorkspaceThumbnails::handle_frame(int view_id)
+{
+    auto& thumbnail = thumbnails[view_id];
+    thumbnail.texture = thumbnail.capture->get_texture();
+    log_stats(g_get_monotonic_time());
+    updated.emit(view_id);
+}
+
+WorkspaceThumbnailStats WayfireWorkspaceThumbnails::get_stats() const
+{
+    WorkspaceThumbnailStats stats;
+    stats.captures = released_stats;
+    for (auto& [_, thumbnail] : thumbnails)
+    {
+        if (thumbnail.capture)
+        {
+            stats.captures.add(thumbnail.capture->get_stats());
+            stats.buffer_bytes += thumbnail.capture->get_buffer_bytes();
+        }
+    }
+
+    return stats;
+}
+
+void WayfireWorkspaceThumbnails::log_stats(int64_t now)
+{
+    if (now - logged_at >= 1000000)
+    {
+        auto stats = get_stats();
+        LOGD("thumbnails: ", stats.captures.frames - logged_frames, " frames in ", (now - logged_at) / 1000,
+            " ms, ", stats.buffer_bytes / 1024, " KiB of buffers held, ",
+            stats.captures.cpu_us / 1000, " ms CPU in total");
+        logged_frames = stats.captures.frames;
+        logged_at     = now;
+    }
+}
+
+std::string WayfireWorkspaceThumbnails::dump_stats() const
+{
+    auto stats = get_stats();
+    wf::json_t dump;
+    dump["views"]  = (uint64_t)thumbnails.size();
+    dump["frames"] = stats.captures.frames;
+    dump["failed"] = stats.captures.failed;
+    dump["pixels"] = stats.captures.pixels;
+    dump["capture-us"]     = stats.captures.capture_us;
+    dump["max-capture-us"] = stats.captures.max_capture_us;
+    dump["cpu-us"] = stats.captures.cpu_us;
+    dump["buffer-bytes"] = (uint64_t)stats.buffer_bytes;
+    return dump.serialize();
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <gtkmm.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "window-list/capture.hpp"
+
+/* The thumbnail of a single view */
+struct WorkspaceThumbnail
+{
+    /* Requested thumbnail size and refresh priority */
+    int width = 0, height = 0;
+    int priority = 0;
+
+    /* Null until the toplevel of the view is known */
+    std::unique_ptr<ToplevelCapture> capture;
+    sigc::connection frame_signal;
+    /* The latest frame, kept when the capture stops */
+    Glib::RefPtr<Gdk::Texture> texture;
+};
+
+struct WorkspaceThumbnailStats
+{
+    ToplevelCaptureStats captures;
+    /* Capture buffers currently held */
+    size_t buffer_bytes = 0;
+};
+
+/**
+ * Keeps live thumbnails of views for the workspace switchers of all outputs.
+ *
+ * Views are captured with the ToplevelCapture of the window list previews,
+ * so the thumbnails share the frame rate, pixel rate and memory budgets of
+ * the TooltipMediaScheduler with them. Views on the shown workspaces are
+ * captured at a higher priority, so they are refreshed first when the
+ * budget is exhausted.
+ */
+class WayfireWorkspaceThumbnails
+{
+  public:
+    using type_signal_thumbnail = sigc::signal<void (int)>;
+
+    WayfireWorkspaceThumbnails();
+    ~WayfireWorkspaceThumbnails();
+
+    static std::shared_ptr<WayfireWorkspaceThumbnails> get_instance();
+    /* The running instance, without creating one */
+    static std::shared_ptr<WayfireWorkspaceThumbnails> find_instance();
+
+    /* False if the compositor cannot capture views */
+    bool is_available() const;
+    /**
+     * Keep a thumbnail of the view of about the given size. Requesting an
+     * already requested view only updates its size and priority.
+     */
+    void request(int view_id, int priority, int width, int height);
+    void release(int view_id);
+    /* The latest thumbnail of the view, null if there is none yet */
+    Glib::RefPtr<Gdk::Texture> get(int view_id) const;
+
+    /* Emitted with the view id when a new thumbnail is ready */
+    type_signal_thumbnail signal_updated()
+    {
+        return updated;
+    }
+
+    /* Totals of all captures, including released ones */
+    WorkspaceThumbnailStats get_stats() const;
+    /* Counters as JSON */
+    std::string dump_stats() const;
+
+  private:
+    std::shared_ptr<ToplevelCaptureContext> context;
+    std::unordered_map<int, WorkspaceThumbnail> thumbnails;
+    /* Totals of the captures which are gone */
+    ToplevelCaptureStats released_stats;
+    sigc::connection toplevel_done_signal;
+
+    /* Frames and monotonic time of the last stats log */
+    uint64_t logged_frames = 0;
+    int64_t logged_at = 0;
+    type_signal_thumbnail updated;
+
+    inline static std::weak_ptr<WayfireWorkspaceThumbnails> instance;
+
+    /* Capture the view if its toplevel is known and it is not captured already */
+    void start_capture(int view_id, WorkspaceThumbnail& thumbnail);
+    void stop_capture(WorkspaceThumbnail& thumbnail);
+    void handle_toplevel_done(ext_foreign_toplevel_handle_v1 *handle);
+    void handle_frame(int view_id);
+    /* Logged from the frame path, at most once a second */
+    void log_stats(int64_t now);
+};
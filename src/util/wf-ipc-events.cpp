@@ -0,0 +1,197 @@
+#include <unordered_map>
+
+#include "wf-ipc-events.hpp"
+
+IPCEventKind ipc_event_kind_from_name(const std::string& name)
+{
+    static const std::unordered_map<std::string, IPCEventKind> kinds = {
+        {"view-mapped", IPCEventKind::VIEW_MAPPED},
+        {"view-unmapped", IPCEventKind::VIEW_UNMAPPED},
+        {"view-focused", IPCEventKind::VIEW_FOCUSED},
+        {"view-minimized", IPCEventKind::VIEW_MINIMIZED},
+        {"view-set-output", IPCEventKind::VIEW_SET_OUTPUT},
+        {"view-geometry-changed", IPCEventKind::VIEW_GEOMETRY_CHANGED},
+        {"view-wset-changed", IPCEventKind::VIEW_WSET_CHANGED},
+        {"output-added", IPCEventKind::OUTPUT_ADDED},
+        {"output-removed", IPCEventKind::OUTPUT_REMOVED},
+        {"output-wset-changed", IPCEventKind::OUTPUT_WSET_CHANGED},
+        {"output-layout-changed", IPCEventKind::OUTPUT_LAYOUT_CHANGED},
+        {"wset-workspace-changed", IPCEventKind::WSET_WORKSPACE_CHANGED},
+        {"keyboard-modifier-state-changed", IPCEventKind::KEYBOARD_MODIFIER_STATE_CHANGED},
+    };
+
+    auto it = kinds.find(name);
+    return (it == kinds.end()) ? IPCEventKind::UNKNOWN : it->second;
+}
+
+/* Geometry is sent as int or double depending on the compositor version */
+template<class Json>
+static double as_number(const Json& value)
+{
+    if (value.is_int())
+    {
+        return value.as_int();
+    }
+
+    return value.as_double();
+}
+
+template<class Json>
+static IPCGeometry decode_geometry(const Json& geometry)
+{
+    IPCGeometry result;
+    result.x     = as_number(geometry["x"]);
+    result.y     = as_number(geometry["y"]);
+    result.width = as_number(geometry["width"]);
+    result.height = as_number(geometry["height"]);
+    return result;
+}
+
+template<class Json>
+static IPCView decode_view(const Json& view)
+{
+    IPCView result;
+    result.id   = view["id"].as_int();
+    result.type = view["type"].as_string();
+    if (view.has_member("app-id"))
+    {
+        result.app_id = view["app-id"].as_string();
+    }
+
+    if (view.has_member("output-id"))
+    {
+        result.output_id   = view["output-id"].as_int();
+        result.output_name = view["output-name"].as_string();
+    }
+
+    if (view.has_member("wset-index"))
+    {
+        result.wset_index = view["wset-index"].as_int();
+    }
+
+    result.minimized = view.has_member("minimized") && view["minimized"].as_bool();
+    result.activated = view.has_member("activated") && view["activated"].as_bool();
+
+    if (view.has_member("geometry"))
+    {
+        result.geometry = decode_geometry(view["geometry"]);
+    }
+
+    return result;
+}
+
+template<class Json>
+static void decode_workspace(const Json& workspace, IPCWset& wset)
+{
+    wset.grid_width  = workspace["grid_width"].as_int();
+    wset.grid_height = workspace["grid_height"].as_int();
+    wset.workspace_x = workspace["x"].as_int();
+    wset.workspace_y = workspace["y"].as_int();
+}
+
+IPCView decode_ipc_view(const wf::json_t& view)
+{
+    return decode_view(view);
+}
+
+std::vector<IPCView> decode_ipc_views(const wf::json_t& views)
+{
+    std::vector<IPCView> result;
+    result.reserve(views.size());
+    for (size_t i = 0; i < views.size(); i++)
+    {
+        result.push_back(decode_view(views[i]));
+    }
+
+    return result;
+}
+
+std::vector<IPCOutput> decode_ipc_outputs(const wf::json_t& outputs)
+{
+    std::vector<IPCOutput> result;
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        IPCOutput output;
+        output.id   = outputs[i]["id"].as_int();
+        output.name = outputs[i]["name"].as_string();
+        output.geometry = decode_geometry(outputs[i]["geometry"]);
+        if (outputs[i].has_member("wset-index"))
+        {
+            output.wset_index = outputs[i]["wset-index"].as_int();
+        }
+
+        result.push_back(output);
+    }
+
+    return result;
+}
+
+std::vector<IPCWset> decode_ipc_wsets(const wf::json_t& wsets)
+{
+    std::vector<IPCWset> result;
+    for (size_t i = 0; i < wsets.size(); i++)
+    {
+        IPCWset wset;
+        wset.index = wsets[i]["index"].as_int();
+        if (wsets[i].has_member("output-id"))
+        {
+            wset.output_id = wsets[i]["output-id"].as_int();
+        }
+
+        decode_workspace(wsets[i]["workspace"], wset);
+        result.push_back(wset);
+    }
+
+    return result;
+}
+
+IPCEvent::IPCEvent(IPCEventKind kind, const wf::json_t& data) : kind(kind), data(data)
+{
+    switch (kind)
+    {
+      case IPCEventKind::VIEW_MAPPED:
+      case IPCEventKind::VIEW_UNMAPPED:
+      case IPCEventKind::VIEW_FOCUSED:
+      case IPCEventKind::VIEW_MINIMIZED:
+      case IPCEventKind::VIEW_SET_OUTPUT:
+      case IPCEventKind::VIEW_GEOMETRY_CHANGED:
+      case IPCEventKind::VIEW_WSET_CHANGED:
+        has_view = data.has_member("view") && data["view"].is_object();
+        if (has_view)
+        {
+            view = decode_view(data["view"]);
+        }
+
+        break;
+
+      case IPCEventKind::WSET_WORKSPACE_CHANGED:
+        if (data.has_member("output"))
+        {
+            output_id = data["output"].as_int();
+        }
+
+        if (data.has_member("wset"))
+        {
+            wset_index = data["wset"].as_int();
+        }
+
+        if (data.has_member("new-workspace"))
+        {
+            workspace_x = data["new-workspace"]["x"].as_int();
+            workspace_y = data["new-workspace"]["y"].as_int();
+        }
+
+        break;
+
+      case IPCEventKind::KEYBOARD_MODIFIER_STATE_CHANGED:
+        layout_index = data["state"]["layout-index"].as_int();
+        break;
+
+      case IPCEventKind::OUTPUT_ADDED:
+      case IPCEventKind::OUTPUT_REMOVED:
+      case IPCEventKind::OUTPUT_WSET_CHANGED:
+      case IPCEventKind::OUTPUT_LAYOUT_CHANGED:
+      case IPCEventKind::UNKNOWN:
+        break;
+    }
+}
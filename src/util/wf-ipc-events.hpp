@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <wayfire/nonstd/json.hpp>
+
+/* Events wf-shell knows how to decode. Anything else is UNKNOWN and only
+ * reachable through IPCEvent::data. */
+enum class IPCEventKind
+{
+    UNKNOWN,
+    VIEW_MAPPED,
+    VIEW_UNMAPPED,
+    VIEW_FOCUSED,
+    VIEW_MINIMIZED,
+    VIEW_SET_OUTPUT,
+    VIEW_GEOMETRY_CHANGED,
+    VIEW_WSET_CHANGED,
+    OUTPUT_ADDED,
+    OUTPUT_REMOVED,
+    OUTPUT_WSET_CHANGED,
+    OUTPUT_LAYOUT_CHANGED,
+    WSET_WORKSPACE_CHANGED,
+    KEYBOARD_MODIFIER_STATE_CHANGED,
+};
+
+IPCEventKind ipc_event_kind_from_name(const std::string& name);
+
+struct IPCGeometry
+{
+    double x = 0, y = 0, width = 0, height = 0;
+};
+
+/* The subset of a window-rules view description the widgets use */
+struct IPCView
+{
+    int id = -1;
+    std::string type;
+    std::string app_id;
+    int output_id = -1;
+    std::string output_name;
+    int wset_index = -1;
+    bool minimized = false;
+    bool activated = false;
+    IPCGeometry geometry;
+
+    bool is_toplevel() const
+    {
+        return type == "toplevel";
+    }
+};
+
+struct IPCOutput
+{
+    int id = -1;
+    std::string name;
+    int wset_index = -1;
+    IPCGeometry geometry;
+};
+
+struct IPCWset
+{
+    int index     = -1;
+    int output_id = -1;
+    int grid_width = 1, grid_height = 1;
+    int workspace_x = 0, workspace_y = 0;
+};
+
+struct IPCEvent
+{
+    IPCEventKind kind = IPCEventKind::UNKNOWN;
+    /* The raw message, for fields which are not decoded */
+    const wf::json_t& data;
+
+    /* view-* events, has_view is false for e.g. a focus change to nothing */
+    bool has_view = false;
+    IPCView view;
+
+    /* wset-workspace-changed */
+    int output_id  = -1;
+    int wset_index = -1;
+    int workspace_x = -1, workspace_y = -1;
+
+    /* keyboard-modifier-state-changed */
+    int layout_index = -1;
+
+    IPCEvent(IPCEventKind kind, const wf::json_t& data);
+};
+
+/* Decode a single entry of a window-rules/list-views reply */
+IPCView decode_ipc_view(const wf::json_t& view);
+/* Decode a whole window-rules/list-views reply */
+std::vector<IPCView> decode_ipc_views(const wf::json_t& views);
+/* Decode window-rules/list-outputs and list-wsets replies */
+std::vector<IPCOutput> decode_ipc_outputs(const wf::json_t& outputs);
+std::vector<IPCWset> decode_ipc_wsets(const wf::json_t& wsets);
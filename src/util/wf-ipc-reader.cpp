@@ -0,0 +1,323 @@
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include <wayfire/util/log.hpp>
+
+#include "wf-ipc-reader.hpp"
+
+IPCFrameBuffer::read_status_t IPCFrameBuffer::read_from(int fd)
+{
+    // Drain everything the socket has in large chunks, the frames are split
+    // out of the accumulated buffer afterwards.
+    while (true)
+    {
+        reserve(READ_CHUNK);
+
+        ssize_t received = ::recv(fd, data.data() + end, data.size() - end, MSG_DONTWAIT);
+        if (received == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                return READ_OK;
+            }
+
+            return READ_ERROR;
+        }
+
+        if (received == 0)
+        {
+            return READ_DISCONNECTED;
+        }
+
+        end += received;
+        total_bytes += received;
+        if (end < data.size())
+        {
+            // Short read, the socket is empty for now
+            return READ_OK;
+        }
+    }
+}
+
+void IPCFrameBuffer::reserve(size_t size)
+{
+    if (data.size() - end >= size)
+    {
+        return;
+    }
+
+    // Move the unparsed tail to the front before growing the buffer
+    if (start > 0)
+    {
+        std::memmove(data.data(), data.data() + start, end - start);
+        end  -= start;
+        start = 0;
+    }
+
+    if (data.size() - end < size)
+    {
+        data.resize(end + size);
+    }
+}
+
+bool IPCFrameBuffer::next_frame(std::string_view& frame)
+{
+    if (start == end)
+    {
+        start = end = 0;
+        return false;
+    }
+
+    uint32_t length;
+    if (end - start < sizeof(length))
+    {
+        return false;
+    }
+
+    std::memcpy(&length, data.data() + start, sizeof(length));
+    if (end - start - sizeof(length) < length)
+    {
+        // Incomplete message, the rest arrives with a later read.
+        // Make sure it fits so that the body is read in one go.
+        reserve(sizeof(length) + length - (end - start));
+        return false;
+    }
+
+    frame  = std::string_view(data.data() + start + sizeof(length), length);
+    start += sizeof(length) + length;
+    return true;
+}
+
+void IPCFrameBuffer::clear()
+{
+    start = end = 0;
+}
+
+WayfireIPCReader::WayfireIPCReader(int socket_fd, IPCFrameBuffer buffer) :
+    socket_fd(socket_fd), buffer(std::move(buffer))
+{
+    wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    space_fd  = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    stop_fd   = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    thread    = std::thread(&WayfireIPCReader::run, this);
+}
+
+WayfireIPCReader::~WayfireIPCReader()
+{
+    if (!stopped)
+    {
+        stop();
+    }
+
+    close(wakeup_fd);
+    close(space_fd);
+    close(stop_fd);
+}
+
+IPCFrameBuffer WayfireIPCReader::stop()
+{
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) < 0)
+    {
+        LOGE("IPC reader: failed to signal stop: ", strerror(errno));
+    }
+
+    thread.join();
+    stopped = true;
+    return std::move(buffer);
+}
+
+void WayfireIPCReader::run()
+{
+    pollfd fds[2];
+    fds[0].fd     = socket_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd     = stop_fd;
+    fds[1].events = POLLIN;
+
+    while (true)
+    {
+        // Frames left over from the main thread come first
+        std::string_view buf;
+        while (buffer.next_frame(buf))
+        {
+            frame_t frame;
+            auto start = std::chrono::steady_clock::now();
+            auto err   = wf::json_t::parse_string(buf, frame.message);
+            frame.bytes    = buf.size();
+            frame.parse_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if (err.has_value())
+            {
+                frame.failed = true;
+                frame.error  = "JSON parse: " + err.value();
+                push(frame);
+                return;
+            }
+
+            if (!push(frame))
+            {
+                unqueued = std::move(frame);
+                return;
+            }
+        }
+
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            frame_t frame;
+            frame.failed = true;
+            frame.error  = std::string("poll failed: ") + strerror(errno);
+            push(frame);
+            return;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            return;
+        }
+
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            continue;
+        }
+
+        auto status = buffer.read_from(socket_fd);
+        if (status != IPCFrameBuffer::READ_OK)
+        {
+            frame_t frame;
+            frame.failed = true;
+            frame.error  = (status == IPCFrameBuffer::READ_DISCONNECTED) ?
+                std::string("Disconnected") : std::string("receive failed: ") + strerror(errno);
+            push(frame);
+            return;
+        }
+    }
+}
+
+bool WayfireIPCReader::push(frame_t& frame)
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    if ((t - head.load(std::memory_order_acquire) == QUEUE_SIZE) && !wait_for_space())
+    {
+        return false;
+    }
+
+    queue[t % QUEUE_SIZE] = std::move(frame);
+    tail.store(t + 1, std::memory_order_release);
+    frames_read.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t one = 1;
+    if (write(wakeup_fd, &one, sizeof(one)) < 0)
+    {
+        // Only fails on counter overflow, the main loop is awake then anyway
+    }
+
+    return true;
+}
+
+bool WayfireIPCReader::wait_for_space()
+{
+    queue_full_stalls.fetch_add(1, std::memory_order_relaxed);
+    pollfd fds[2];
+    fds[0].fd     = space_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd     = stop_fd;
+    fds[1].events = POLLIN;
+
+    while (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) == QUEUE_SIZE)
+    {
+        waiting_for_space.store(true, std::memory_order_seq_cst);
+        // Re-check, the main loop may have drained the queue just now
+        if (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_seq_cst) < QUEUE_SIZE)
+        {
+            break;
+        }
+
+        if ((poll(fds, 2, -1) < 0) && (errno != EINTR))
+        {
+            return false;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            return false;
+        }
+
+        uint64_t count;
+        if (read(space_fd, &count, sizeof(count)) < 0)
+        {
+            // Spurious wakeup, check the queue again
+        }
+    }
+
+    waiting_for_space.store(false, std::memory_order_relaxed);
+    return true;
+}
+
+bool WayfireIPCReader::pop(frame_t& frame)
+{
+    size_t h     = head.load(std::memory_order_relaxed);
+    size_t depth = tail.load(std::memory_order_acquire) - h;
+    if (depth == 0)
+    {
+        if (stopped && unqueued)
+        {
+            frame = std::move(*unqueued);
+            unqueued.reset();
+            return true;
+        }
+
+        return false;
+    }
+
+    max_depth = std::max(max_depth, depth);
+    frame     = std::move(queue[h % QUEUE_SIZE]);
+    head.store(h + 1, std::memory_order_seq_cst);
+    return true;
+}
+
+void WayfireIPCReader::drained()
+{
+    uint64_t count;
+    if (read(wakeup_fd, &count, sizeof(count)) < 0)
+    {
+        // Nothing pending, frames were popped before their wakeup arrived
+    }
+
+    // A frame pushed after the last pop() may have had its wakeup consumed
+    // just now, rearm so it is not left in the queue
+    if (tail.load(std::memory_order_acquire) != head.load(std::memory_order_relaxed))
+    {
+        uint64_t one = 1;
+        if (write(wakeup_fd, &one, sizeof(one)) < 0)
+        {
+            // The eventfd is readable anyway
+        }
+    }
+
+    if (waiting_for_space.exchange(false))
+    {
+        uint64_t one = 1;
+        if (write(space_fd, &one, sizeof(one)) < 0)
+        {
+            // The reader re-checks the queue before sleeping again
+        }
+    }
+}
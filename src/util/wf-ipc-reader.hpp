@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <wayfire/nonstd/json.hpp>
+
+/**
+ * Accumulates bytes read from the IPC socket and splits them into
+ * length-prefixed frames. A partial frame stays buffered until the rest
+ * of it has been read.
+ */
+class IPCFrameBuffer
+{
+  public:
+    enum read_status_t
+    {
+        READ_OK,
+        READ_DISCONNECTED,
+        READ_ERROR,
+    };
+
+    /* Read everything currently available on the non-blocking fd */
+    read_status_t read_from(int fd);
+    /**
+     * Get the next complete frame. The view is valid until the next call
+     * to any method of the buffer.
+     *
+     * @return false if there is no complete frame buffered
+     */
+    bool next_frame(std::string_view& frame);
+    void clear();
+    /* Bytes received so far, for statistics */
+    uint64_t total_bytes = 0;
+
+  private:
+    static constexpr size_t READ_CHUNK = 64 * 1024;
+    /* [start, end) is not yet parsed */
+    std::vector<char> data;
+    size_t start = 0;
+    size_t end   = 0;
+
+    void reserve(size_t size);
+};
+
+/**
+ * Owns the reading side of the IPC socket on a separate thread. Frames are
+ * parsed there and handed to the main loop through a bounded lock-free
+ * queue, whose eventfd wakes up the main loop.
+ */
+class WayfireIPCReader
+{
+  public:
+    struct frame_t
+    {
+        wf::json_t message;
+        /* The connection broke or sent garbage, message is unset */
+        bool failed = false;
+        std::string error;
+        /* Size of the frame and the time it took to parse it */
+        size_t bytes     = 0;
+        uint64_t parse_us = 0;
+    };
+
+    /* Starts reading right away, continuing with the bytes already in buffer */
+    WayfireIPCReader(int socket_fd, IPCFrameBuffer buffer);
+    ~WayfireIPCReader();
+
+    /**
+     * Stop and join the thread. Frames parsed so far can still be taken with
+     * pop() afterwards.
+     *
+     * @return The bytes which were read but not parsed yet
+     */
+    IPCFrameBuffer stop();
+
+    /* Readable whenever frames are waiting in the queue */
+    int get_wakeup_fd() const
+    {
+        return wakeup_fd;
+    }
+
+    /**
+     * Take the next parsed frame, only from the main thread.
+     *
+     * @return false if the queue is empty
+     */
+    bool pop(frame_t& frame);
+    /* Acknowledge the wakeup and let a stalled reader continue. Call after
+     * draining the queue with pop(). */
+    void drained();
+
+    /* Statistics */
+    uint64_t get_frame_count() const
+    {
+        return frames_read.load(std::memory_order_relaxed);
+    }
+
+    uint64_t get_stall_count() const
+    {
+        return queue_full_stalls.load(std::memory_order_relaxed);
+    }
+
+    size_t get_max_depth() const
+    {
+        return max_depth;
+    }
+
+  private:
+    static constexpr size_t QUEUE_SIZE = 256;
+    std::array<frame_t, QUEUE_SIZE> queue;
+    std::atomic<size_t> head{0}, tail{0};
+    std::atomic<bool> waiting_for_space{false};
+
+    /* Parsed but not queued when the thread was stopped */
+    std::optional<frame_t> unqueued;
+
+    int socket_fd;
+    IPCFrameBuffer buffer;
+    bool stopped = false;
+    int wakeup_fd = -1;
+    int space_fd  = -1;
+    int stop_fd   = -1;
+    std::thread thread;
+
+    std::atomic<uint64_t> frames_read{0};
+    std::atomic<uint64_t> queue_full_stalls{0};
+    size_t max_depth = 0;
+
+    void run();
+    bool push(frame_t& frame);
+    bool wait_for_space();
+};
@@ -0,0 +1,525 @@
+#include <algorithm>
+#include <iostream>
+#include <glibmm/main.h>
+
+#include "wf-ipc-state.hpp"
+
+/* Bits of WayfireIPCState::loaded */
+static constexpr int LOADED_VIEWS    = 1 << 0;
+static constexpr int LOADED_WSETS    = 1 << 1;
+static constexpr int LOADED_OUTPUTS  = 1 << 2;
+static constexpr int LOADED_KEYBOARD = 1 << 3;
+
+/* Failed queries are sent again after this, doubling up to the maximum */
+static constexpr int QUERY_RETRY_MIN_MS = 1000;
+static constexpr int QUERY_RETRY_MAX_MS = 30000;
+
+/* The events each group is kept up to date with, coalesced ones apart */
+static std::vector<std::string> group_events(IPCStateGroup group)
+{
+    switch (group)
+    {
+      case IPCStateGroup::VIEWS:
+        return {"view-mapped", "view-unmapped", "view-focused", "view-minimized", "view-set-output",
+            "view-wset-changed"};
+
+      case IPCStateGroup::WORKSPACES:
+        return {"output-added", "output-removed", "output-wset-changed", "output-layout-changed",
+            "wset-workspace-changed"};
+
+      case IPCStateGroup::KEYBOARD:
+        return {"keyboard-modifier-state-changed"};
+    }
+
+    return {};
+}
+
+/* The LOADED_* bits which make up a group */
+static int group_loaded_bits(IPCStateGroup group)
+{
+    switch (group)
+    {
+      case IPCStateGroup::VIEWS:
+        return LOADED_VIEWS;
+
+      case IPCStateGroup::WORKSPACES:
+        return LOADED_WSETS | LOADED_OUTPUTS;
+
+      case IPCStateGroup::KEYBOARD:
+        return LOADED_KEYBOARD;
+    }
+
+    return 0;
+}
+
+/* Events of the group of which only the newest one per view matters */
+static std::vector<std::string> group_coalesced_events(IPCStateGroup group)
+{
+    if (group == IPCStateGroup::VIEWS)
+    {
+        return {"view-geometry-changed"};
+    }
+
+    return {};
+}
+
+IPCStateWatch::IPCStateWatch(std::weak_ptr<WayfireIPCState> state, IPCStateGroup group) :
+    state(state), group(group)
+{}
+
+IPCStateWatch::~IPCStateWatch()
+{
+    if (auto ipc_state = state.lock())
+    {
+        ipc_state->remove_watch(group);
+    }
+}
+
+WayfireIPCState::WayfireIPCState()
+{
+    ipc_client = WayfireIPC::get_instance()->create_client();
+}
+
+WayfireIPCState::~WayfireIPCState()
+{
+    for (auto& timer : retry_timers)
+    {
+        timer.disconnect();
+    }
+
+    ipc_client->unsubscribe(this);
+}
+
+std::shared_ptr<WayfireIPCState> WayfireIPCState::get_instance()
+{
+    auto state = instance.lock();
+    if (!state)
+    {
+        state    = std::make_shared<WayfireIPCState>();
+        instance = state;
+    }
+
+    return state;
+}
+
+std::unique_ptr<IPCStateWatch> WayfireIPCState::watch(IPCStateGroup group)
+{
+    add_watch(group);
+    return std::make_unique<IPCStateWatch>(instance, group);
+}
+
+void WayfireIPCState::add_watch(IPCStateGroup group)
+{
+    if (watchers[(int)group]++ > 0)
+    {
+        return;
+    }
+
+    // Subscribed before the query, so no event after its snapshot is missed
+    ipc_client->subscribe(this, group_events(group));
+    auto coalesced = group_coalesced_events(group);
+    if (!coalesced.empty())
+    {
+        ipc_client->subscribe(this, coalesced, true);
+    }
+
+    load(group);
+}
+
+void WayfireIPCState::remove_watch(IPCStateGroup group)
+{
+    if (--watchers[(int)group] > 0)
+    {
+        return;
+    }
+
+    auto events    = group_events(group);
+    auto coalesced = group_coalesced_events(group);
+    events.insert(events.end(), coalesced.begin(), coalesced.end());
+    ipc_client->unsubscribe(this, events);
+
+    // Not kept up to date anymore
+    loaded &= ~group_loaded_bits(group);
+    switch (group)
+    {
+      case IPCStateGroup::VIEWS:
+        views.clear();
+        view_order.clear();
+        focused_view_id = -1;
+        break;
+
+      case IPCStateGroup::WORKSPACES:
+        wsets.clear();
+        outputs.clear();
+        break;
+
+      case IPCStateGroup::KEYBOARD:
+        keyboard = {};
+        break;
+    }
+}
+
+void WayfireIPCState::refresh()
+{
+    // Pipelined, so all are answered in a single round trip. Events reach
+    // the state in the order they were sent relative to the replies, so each
+    // reply is applied as soon as it arrives: earlier events are part of it,
+    // later ones are applied on top of it.
+    for (auto group : {IPCStateGroup::VIEWS, IPCStateGroup::WORKSPACES, IPCStateGroup::KEYBOARD})
+    {
+        if (is_watched(group))
+        {
+            load(group);
+        }
+    }
+}
+
+void WayfireIPCState::load(IPCStateGroup group)
+{
+    switch (group)
+    {
+      case IPCStateGroup::VIEWS:
+        query(group, "window-rules/list-views", "views list", QUERY_RETRY_MIN_MS,
+            [=] (const wf::json_t& reply) { apply_views(reply); });
+        break;
+
+      case IPCStateGroup::WORKSPACES:
+        refresh_outputs();
+        break;
+
+      case IPCStateGroup::KEYBOARD:
+        query(group, "wayfire/get-keyboard-state", "keyboard state", QUERY_RETRY_MIN_MS,
+            [=] (const wf::json_t& reply)
+        {
+            set_keyboard(reply);
+            mark_loaded(LOADED_KEYBOARD);
+        });
+        break;
+    }
+}
+
+void WayfireIPCState::refresh_outputs()
+{
+    query(IPCStateGroup::WORKSPACES, "window-rules/list-wsets", "wsets list", QUERY_RETRY_MIN_MS,
+        [=] (const wf::json_t& reply) { apply_wsets(reply); });
+    query(IPCStateGroup::WORKSPACES, "window-rules/list-outputs", "outputs list", QUERY_RETRY_MIN_MS,
+        [=] (const wf::json_t& reply) { apply_outputs(reply); });
+}
+
+void WayfireIPCState::query(IPCStateGroup group, const std::string& method, const std::string& what,
+    int retry_ms, std::function<void(const wf::json_t&)> apply)
+{
+    if (!is_watched(group))
+    {
+        return;
+    }
+
+    ipc_client->send("{\"method\":\"" + method + "\"}", [=] (wf::json_t reply)
+    {
+        // Released while the query was in flight, a later watch queries again
+        if (!is_watched(group))
+        {
+            return;
+        }
+
+        if (!reply.has_member("error"))
+        {
+            apply(reply);
+            return;
+        }
+
+        // Everything is queried again once the connection is back
+        if (reply["error"].is_string() && (reply["error"].as_string() == "disconnected"))
+        {
+            return;
+        }
+
+        std::cerr << reply.serialize() << std::endl;
+        std::cerr << "Error getting " << what << " from wayfire. Is ipc-rules plugin enabled?" << std::endl;
+        retry_timers.erase(std::remove_if(retry_timers.begin(), retry_timers.end(),
+            [] (const sigc::connection& timer) { return !timer.connected(); }), retry_timers.end());
+        retry_timers.push_back(Glib::signal_timeout().connect([=] ()
+        {
+            query(group, method, what, std::min(retry_ms * 2, QUERY_RETRY_MAX_MS), apply);
+            return false;
+        }, retry_ms));
+    });
+}
+
+void WayfireIPCState::mark_loaded(int part)
+{
+    bool reloaded = (loaded & part);
+    loaded |= part;
+    if (!reloaded || (part == LOADED_VIEWS))
+    {
+        reset.emit();
+    } else if (part == LOADED_KEYBOARD)
+    {
+        keyboard_changed.emit(keyboard);
+    } else
+    {
+        outputs_changed.emit();
+    }
+}
+
+void WayfireIPCState::apply_views(const wf::json_t& reply)
+{
+    views.clear();
+    view_order.clear();
+    focused_view_id = -1;
+    for (auto& view : decode_ipc_views(reply))
+    {
+        if (view.activated)
+        {
+            focused_view_id = view.id;
+        }
+
+        views[view.id] = view;
+        view_order.push_back(view.id);
+    }
+
+    mark_loaded(LOADED_VIEWS);
+}
+
+void WayfireIPCState::apply_wsets(const wf::json_t& reply)
+{
+    wsets.clear();
+    for (auto& wset : decode_ipc_wsets(reply))
+    {
+        wsets[wset.index] = wset;
+    }
+
+    mark_loaded(LOADED_WSETS);
+}
+
+void WayfireIPCState::apply_outputs(const wf::json_t& reply)
+{
+    outputs.clear();
+    for (auto& output : decode_ipc_outputs(reply))
+    {
+        outputs[output.id] = output;
+    }
+
+    mark_loaded(LOADED_OUTPUTS);
+}
+
+bool WayfireIPCState::is_ready(IPCStateGroup group) const
+{
+    int bits = group_loaded_bits(group);
+    return (loaded & bits) == bits;
+}
+
+void WayfireIPCState::set_keyboard(const wf::json_t& state)
+{
+    keyboard.layout_index = state["layout-index"].as_int();
+    keyboard.layouts.clear();
+    for (size_t i = 0; i < state["possible-layouts"].size(); i++)
+    {
+        keyboard.layouts.push_back(state["possible-layouts"][i].as_string());
+    }
+}
+
+WayfireIPCState::output_signals_t*WayfireIPCState::find_output_signals(const std::string& output_name)
+{
+    auto it = output_signals.find(output_name);
+    return (it == output_signals.end()) ? nullptr : &it->second;
+}
+
+void WayfireIPCState::emit_view_changed(const IPCView& view)
+{
+    view_changed.emit(view);
+    if (auto signals = find_output_signals(view.output_name))
+    {
+        signals->view_changed.emit(view);
+    }
+}
+
+void WayfireIPCState::raise_view(int view_id)
+{
+    auto it = std::find(view_order.begin(), view_order.end(), view_id);
+    if (it != view_order.end())
+    {
+        view_order.erase(it);
+    }
+
+    view_order.push_back(view_id);
+}
+
+void WayfireIPCState::update_view(const IPCView& view)
+{
+    if (!views.count(view.id))
+    {
+        // Newly mapped views are on top
+        view_order.push_back(view.id);
+    }
+
+    auto& stored = views[view.id];
+    if ((stored.id == view.id) && (stored.output_name != view.output_name))
+    {
+        if (auto signals = find_output_signals(stored.output_name))
+        {
+            signals->view_removed.emit(view.id);
+        }
+    }
+
+    stored = view;
+    emit_view_changed(view);
+}
+
+void WayfireIPCState::on_event(const IPCEvent& event)
+{
+    switch (event.kind)
+    {
+      case IPCEventKind::VIEW_MAPPED:
+      case IPCEventKind::VIEW_MINIMIZED:
+      case IPCEventKind::VIEW_SET_OUTPUT:
+      case IPCEventKind::VIEW_WSET_CHANGED:
+      case IPCEventKind::VIEW_GEOMETRY_CHANGED:
+        if (event.has_view)
+        {
+            update_view(event.view);
+        }
+
+        break;
+
+      case IPCEventKind::VIEW_FOCUSED:
+      {
+        int new_focus = event.has_view ? event.view.id : -1;
+        auto old_view = views.find(focused_view_id);
+        if ((focused_view_id != new_focus) && (old_view != views.end()))
+        {
+            old_view->second.activated = false;
+            emit_view_changed(old_view->second);
+        }
+
+        focused_view_id = new_focus;
+        if (event.has_view)
+        {
+            update_view(event.view);
+            // Focusing a view raises it
+            raise_view(event.view.id);
+        }
+
+        break;
+      }
+
+      case IPCEventKind::VIEW_UNMAPPED:
+      {
+        auto view = event.has_view ? views.find(event.view.id) : views.end();
+        if (view == views.end())
+        {
+            break;
+        }
+
+        std::string output_name = view->second.output_name;
+        views.erase(view);
+        view_order.erase(std::remove(view_order.begin(), view_order.end(), event.view.id), view_order.end());
+        if (focused_view_id == event.view.id)
+        {
+            focused_view_id = -1;
+        }
+
+        view_removed.emit(event.view.id);
+        if (auto signals = find_output_signals(output_name))
+        {
+            signals->view_removed.emit(event.view.id);
+        }
+
+        break;
+      }
+
+      case IPCEventKind::WSET_WORKSPACE_CHANGED:
+      {
+        auto wset = wsets.find(event.wset_index);
+        if (wset == wsets.end())
+        {
+            refresh_outputs();
+            break;
+        }
+
+        wset->second.workspace_x = event.workspace_x;
+        wset->second.workspace_y = event.workspace_y;
+        wset_changed.emit(wset->second);
+        auto output  = get_output(wset->second.output_id);
+        auto signals = output ? find_output_signals(output->name) : nullptr;
+        if (signals)
+        {
+            signals->wset_changed.emit(wset->second);
+        }
+
+        break;
+      }
+
+      case IPCEventKind::OUTPUT_ADDED:
+      case IPCEventKind::OUTPUT_REMOVED:
+      case IPCEventKind::OUTPUT_WSET_CHANGED:
+      case IPCEventKind::OUTPUT_LAYOUT_CHANGED:
+        refresh_outputs();
+        break;
+
+      case IPCEventKind::KEYBOARD_MODIFIER_STATE_CHANGED:
+        set_keyboard(event.data["state"]);
+        keyboard_changed.emit(keyboard);
+        break;
+
+      default:
+        break;
+    }
+}
+
+void WayfireIPCState::on_reconnected()
+{
+    // Events were lost, nothing is known until it was queried again
+    for (auto& timer : retry_timers)
+    {
+        timer.disconnect();
+    }
+
+    retry_timers.clear();
+    loaded = 0;
+    refresh();
+}
+
+const IPCView*WayfireIPCState::get_view(int id) const
+{
+    auto it = views.find(id);
+    return (it == views.end()) ? nullptr : &it->second;
+}
+
+const IPCWset*WayfireIPCState::get_wset(int index) const
+{
+    auto it = wsets.find(index);
+    return (it == wsets.end()) ? nullptr : &it->second;
+}
+
+const IPCOutput*WayfireIPCState::get_output(int id) const
+{
+    auto it = outputs.find(id);
+    return (it == outputs.end()) ? nullptr : &it->second;
+}
+
+const IPCOutput*WayfireIPCState::get_output(const std::string& name) const
+{
+    for (auto& [_, output] : outputs)
+    {
+        if (output.name == name)
+        {
+            return &output;
+        }
+    }
+
+    return nullptr;
+}
+
+const IPCWset*WayfireIPCState::get_output_wset(int output_id) const
+{
+    for (auto& [_, wset] : wsets)
+    {
+        if (wset.output_id == output_id)
+        {
+            return &wset;
+        }
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sigc++/signal.h>
+
+#include "wf-ipc.hpp"
+
+struct IPCKeyboardState
+{
+    int layout_index = 0;
+    std::vector<std::string> layouts;
+};
+
+using type_signal_ipc_view = sigc::signal<void (const IPCView&)>;
+using type_signal_ipc_view_id = sigc::signal<void (int)>;
+using type_signal_ipc_wset = sigc::signal<void (const IPCWset&)>;
+using type_signal_ipc_keyboard = sigc::signal<void (const IPCKeyboardState&)>;
+using type_signal_ipc_simple   = sigc::signal<void (void)>;
+
+/* Parts of the state which are loaded independently of each other */
+enum class IPCStateGroup
+{
+    /* Views and the focused view */
+    VIEWS,
+    /* Outputs and their workspace sets */
+    WORKSPACES,
+    KEYBOARD,
+};
+
+class WayfireIPCState;
+
+/**
+ * Keeps a group of the state subscribed and loaded while held. The events
+ * of a group are only watched while at least one consumer holds a watch.
+ */
+class IPCStateWatch
+{
+    std::weak_ptr<WayfireIPCState> state;
+    IPCStateGroup group;
+
+  public:
+    IPCStateWatch(std::weak_ptr<WayfireIPCState> state, IPCStateGroup group);
+    ~IPCStateWatch();
+    IPCStateWatch(const IPCStateWatch&) = delete;
+    IPCStateWatch& operator =(const IPCStateWatch&) = delete;
+};
+
+/**
+ * A process-wide model of the compositor state that widgets commonly need:
+ * views, workspace sets, outputs and the keyboard layout.
+ *
+ * Each group is seeded with a bulk query once it is watched and then kept
+ * up to date from IPC events, so widgets can read it instead of sending
+ * their own requests.
+ */
+class WayfireIPCState : public IIPCSubscriber
+{
+  private:
+    std::shared_ptr<IPCClient> ipc_client;
+
+    std::unordered_map<int, IPCView> views;
+    /* Ids of the views, bottom to top */
+    std::vector<int> view_order;
+    std::unordered_map<int, IPCWset> wsets;
+    std::unordered_map<int, IPCOutput> outputs;
+    IPCKeyboardState keyboard;
+    int focused_view_id = -1;
+    /* LOADED_* bits of the snapshots which were applied */
+    int loaded = 0;
+    /* Number of IPCStateWatch held for each group */
+    int watchers[3] = {0, 0, 0};
+    /* Failed queries sent again later */
+    std::vector<sigc::connection> retry_timers;
+
+    type_signal_ipc_view view_changed;
+    type_signal_ipc_view_id view_removed;
+    type_signal_ipc_wset wset_changed;
+    type_signal_ipc_keyboard keyboard_changed;
+    type_signal_ipc_simple outputs_changed, reset;
+
+    /* The view and wset signals again, for each output by name */
+    struct output_signals_t
+    {
+        type_signal_ipc_view view_changed;
+        type_signal_ipc_view_id view_removed;
+        type_signal_ipc_wset wset_changed;
+    };
+    std::unordered_map<std::string, output_signals_t> output_signals;
+    output_signals_t *find_output_signals(const std::string& output_name);
+    void emit_view_changed(const IPCView& view);
+
+    inline static std::weak_ptr<WayfireIPCState> instance;
+
+    void refresh();
+    void refresh_outputs();
+    void load(IPCStateGroup group);
+    /* Send a query and apply its reply as soon as it arrives, retrying on errors.
+     * Dropped once the group is not watched anymore. */
+    void query(IPCStateGroup group, const std::string& method, const std::string& what, int retry_ms,
+        std::function<void(const wf::json_t&)> apply);
+    bool is_watched(IPCStateGroup group) const
+    {
+        return watchers[(int)group] > 0;
+    }
+
+    friend class IPCStateWatch;
+    void add_watch(IPCStateGroup group);
+    void remove_watch(IPCStateGroup group);
+    void mark_loaded(int part);
+    void apply_views(const wf::json_t& reply);
+    void apply_wsets(const wf::json_t& reply);
+    void apply_outputs(const wf::json_t& reply);
+    void set_keyboard(const wf::json_t& state);
+    void update_view(const IPCView& view);
+    void raise_view(int view_id);
+
+  public:
+    WayfireIPCState();
+    ~WayfireIPCState();
+
+    void on_event(const IPCEvent& event) override;
+    void on_reconnected() override;
+
+    /* Emitted when a view is mapped or any of its decoded fields changed */
+    type_signal_ipc_view signal_view_changed()
+    {
+        return view_changed;
+    }
+
+    /* Emitted with the id of a view which was unmapped */
+    type_signal_ipc_view_id signal_view_removed()
+    {
+        return view_removed;
+    }
+
+    /* Emitted when the current workspace of a wset changed */
+    type_signal_ipc_wset signal_wset_changed()
+    {
+        return wset_changed;
+    }
+
+    type_signal_ipc_keyboard signal_keyboard_changed()
+    {
+        return keyboard_changed;
+    }
+
+    /* Emitted when outputs were added, removed or moved to another wset.
+     * Outputs and wsets are reloaded as a whole in that case. */
+    type_signal_ipc_simple signal_outputs_changed()
+    {
+        return outputs_changed;
+    }
+
+    /**
+     * Like the signals above, but only for the views and the wset on the
+     * named output, so that per-output widgets do not have to filter every
+     * event. A view moving to another output is removed from the old one.
+     */
+    type_signal_ipc_view signal_output_view_changed(const std::string& output_name)
+    {
+        return output_signals[output_name].view_changed;
+    }
+
+    type_signal_ipc_view_id signal_output_view_removed(const std::string& output_name)
+    {
+        return output_signals[output_name].view_removed;
+    }
+
+    type_signal_ipc_wset signal_output_wset_changed(const std::string& output_name)
+    {
+        return output_signals[output_name].wset_changed;
+    }
+
+    /* Emitted when a group was loaded after being unknown, see is_ready(), and on reloads of the views */
+    type_signal_ipc_simple signal_reset()
+    {
+        return reset;
+    }
+
+    /* False until the queries of the group were answered */
+    bool is_ready(IPCStateGroup group) const;
+
+    /* Subscribe to the group and load it, if no one did yet */
+    std::unique_ptr<IPCStateWatch> watch(IPCStateGroup group);
+
+    const std::unordered_map<int, IPCView>& get_views() const
+    {
+        return views;
+    }
+
+    /* The ids of get_views() in stacking order, bottom to top, as listed by
+     * Wayfire and updated with views being mapped and focused */
+    const std::vector<int>& get_view_order() const
+    {
+        return view_order;
+    }
+
+    const IPCView *get_view(int id) const;
+    const IPCWset *get_wset(int index) const;
+    const IPCOutput *get_output(int id) const;
+    const IPCOutput *get_output(const std::string& name) const;
+    /* The wset currently shown on the given output */
+    const IPCWset *get_output_wset(int output_id) const;
+
+    const std::unordered_map<int, IPCOutput>& get_outputs() const
+    {
+        return outputs;
+    }
+
+    const IPCKeyboardState& get_keyboard() const
+    {
+        return keyboard;
+    }
+
+    int get_focused_view_id() const
+    {
+        return focused_view_id;
+    }
+
+    static std::shared_ptr<WayfireIPCState> get_instance();
+};
@@ -1,12 +1,18 @@
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <poll.h>
 
 #include <sigc++/functors/mem_fun.h>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cerrno>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
 #include <optional>
 #include <string_view>
@@ -15,24 +21,77 @@
 
 #include "wf-ipc.hpp"
 
+static uint64_t elapsed_us(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - since).count();
+}
+
+/* Watched when no events are wanted anymore, the compositor never sends it */
+static const char *IPC_NO_EVENTS = "wf-shell-no-events";
+
+/* Requests are small and built by us, so this is enough to find the method */
+static std::string_view method_name(const std::string& message)
+{
+    static constexpr std::string_view key = "\"method\"";
+    size_t start = message.find(key);
+    if (start == std::string::npos)
+    {
+        return "unknown";
+    }
+
+    start = message.find('"', message.find(':', start + key.size()));
+    size_t end = message.find('"', start + 1);
+    if ((start == std::string::npos) || (end == std::string::npos))
+    {
+        return "unknown";
+    }
+
+    return std::string_view(message).substr(start + 1, end - start - 1);
+}
+
+/* Bucket i counts latencies in [2^i, 2^(i+1)) microseconds */
+static int latency_bucket(uint64_t latency_us)
+{
+    int bucket = 0;
+    while ((latency_us >>= 1) && (bucket < IPC_LATENCY_BUCKETS - 1))
+    {
+        bucket++;
+    }
+
+    return bucket;
+}
+
 WayfireIPC::WayfireIPC()
 {
     if (connect())
     {
-        sig_connection = Glib::signal_io().connect(
-            sigc::mem_fun(*this, &WayfireIPC::receive),
-            connection->get_socket()->get_fd(),
-            Glib::IOCondition::IO_IN);
-
         connected = true;
     } else
     {
         std::cerr << "Failed to connect to WAYFIRE_SOCKET. Is wayfire ipc plugin enabled?" << std::endl;
+        // The panel may be started before the compositor listens on the socket
+        schedule_reconnect();
     }
 }
 
 WayfireIPC::~WayfireIPC()
 {
+    LOGD("IPC: ", event_copies_saved, " event copies saved by reference delivery");
+    for (auto lane : {IPCLane::INTERACTIVE, IPCLane::BULK})
+    {
+        auto& stats = get_lane_stats(lane);
+        LOGD("IPC: ", (lane == IPCLane::INTERACTIVE) ? "interactive" : "bulk", " lane: ",
+            stats.requests, " requests, average latency ",
+            stats.requests ? stats.total_ms / stats.requests : 0.0, " ms, max ", stats.max_ms, " ms");
+    }
+
+    for (auto& request : pending_requests)
+    {
+        request.timeout.disconnect();
+    }
+
+    reconnect_timer.disconnect();
     if (connected)
     {
         disconnect();
@@ -53,10 +112,8 @@ bool WayfireIPC::connect()
         auto address = Gio::UnixSocketAddress::create(socket_path);
         connection = client->connect(address);
         connection->get_socket()->set_blocking(false);
-        output = connection->get_output_stream();
-        input  = connection->get_input_stream();
-        cancel = Gio::Cancellable::create();
 
+        start_receiving();
         return true;
     } catch (const Glib::Error& ex)
     {
@@ -67,243 +124,707 @@ bool WayfireIPC::connect()
     return false;
 }
 
-void WayfireIPC::disconnect()
+void WayfireIPC::start_receiving()
 {
-    cancel->cancel();
-    sig_connection.disconnect();
-    connection->close();
+    if (use_reader_thread)
+    {
+        start_reader();
+        return;
+    }
+
+    read_connection = Glib::signal_io().connect(
+        sigc::mem_fun(*this, &WayfireIPC::receive),
+        connection->get_socket()->get_fd(),
+        Glib::IOCondition::IO_IN);
+}
+
+void WayfireIPC::start_reader()
+{
+    reader = std::make_unique<WayfireIPCReader>(connection->get_socket()->get_fd(),
+        std::move(read_buffer));
+    read_buffer.clear();
+    reader_connection = Glib::signal_io().connect(
+        sigc::mem_fun(*this, &WayfireIPC::receive_frames),
+        reader->get_wakeup_fd(), Glib::IOCondition::IO_IN);
 }
 
-void WayfireIPC::send(const std::string& message)
+void WayfireIPC::stop_reader(bool dispatch_queued)
 {
-    send_message(message);
-    response_handlers.push(0);
+    reader_connection.disconnect();
+    auto old_reader = std::move(reader);
+    read_buffer = old_reader->stop();
+    LOGD("IPC reader: ", old_reader->get_frame_count(), " frames, ", old_reader->get_stall_count(),
+        " stalls on a full queue, max queue depth ", old_reader->get_max_depth());
+
+    if (dispatch_queued && dispatch_frames(old_reader.get()))
+    {
+        flush_events();
+    }
 }
 
-void WayfireIPC::send(const std::string& message, int response_handler)
+void WayfireIPC::set_reader_thread(bool enabled)
 {
+    if (use_reader_thread == enabled)
+    {
+        return;
+    }
+
+    use_reader_thread = enabled;
     if (!connected)
     {
+        // Applied on the next connection
         return;
     }
 
-    send_message(message);
-    response_handlers.push(response_handler);
+    // Hand the unparsed bytes over, so no message is lost or reordered
+    if (enabled)
+    {
+        read_connection.disconnect();
+        start_reader();
+    } else
+    {
+        stop_reader(true);
+        if (connected)
+        {
+            start_receiving();
+            // Frames may already be complete in the buffer
+            receive(Glib::IOCondition::IO_IN);
+        }
+    }
+}
+
+void WayfireIPC::disconnect()
+{
+    if (reader)
+    {
+        stop_reader(false);
+    }
+
+    read_connection.disconnect();
+    write_connection.disconnect();
+    connection->close();
 }
 
-void WayfireIPC::send_message(const std::string& message)
+void WayfireIPC::connection_lost()
 {
-    if (output->has_pending() || writing)
+    if (!connected)
     {
-        write_queue.push(message);
-        write_next();
         return;
     }
 
-    // Shortcut: stream is not busy, no queue needed
-    write_stream(message);
+    disconnect();
+    connected  = false;
+    writing    = false;
+    watch_sent = false;
+    write_queue.clear();
+    write_offset = 0;
+    read_buffer.clear();
+    pending_events.clear();
+    pending_event_index.clear();
+
+    // Replies to these will never arrive
+    auto requests = std::move(pending_requests);
+    pending_requests.clear();
+    for (auto& request : requests)
+    {
+        request.timeout.disconnect();
+        if (request.handler)
+        {
+            wf::json_t error;
+            error["error"] = "disconnected";
+            request.handler(error);
+        }
+    }
+
+    reconnect_delay_ms = RECONNECT_MIN_DELAY_MS;
+    schedule_reconnect();
+}
+
+void WayfireIPC::schedule_reconnect()
+{
+    LOGI("IPC: reconnecting in ", reconnect_delay_ms, " ms");
+    reconnect_timer = Glib::signal_timeout().connect([this] ()
+    {
+        try_reconnect();
+        return false;
+    }, reconnect_delay_ms);
+    reconnect_delay_ms = std::min(reconnect_delay_ms * 2, RECONNECT_MAX_DELAY_MS);
 }
 
-void WayfireIPC::write_next()
+void WayfireIPC::try_reconnect()
 {
-    if (writing || cancel->is_cancelled())
+    if (!connect())
     {
+        schedule_reconnect();
         return;
     }
 
-    writing = true;
-    sig_connection = Glib::signal_io().connect(
-        sigc::mem_fun(*this, &WayfireIPC::send_queue),
-        connection->get_socket()->get_fd(),
-        Glib::IOCondition::IO_OUT);
+    LOGI("IPC: reconnected");
+    connected = true;
+
+    // The new connection starts without any watches
+    watch_sent = false;
+    update_watch();
+
+    std::set<IIPCSubscriber*> all_subscribers = subscribers;
+    for (auto& [event, subs] : subscriptions)
+    {
+        all_subscribers.insert(subs.begin(), subs.end());
+    }
+
+    for (auto sub : all_subscribers)
+    {
+        sub->on_reconnected();
+    }
 }
 
-void WayfireIPC::write_stream(const std::string& message)
+void WayfireIPC::send(std::string message)
 {
-    try {
-        writing = true;
-        uint32_t length = message.size();
-        // Pointer to data must be valid until completely wrote and
-        // slot is called, as documented for write_all_async.
-        // So we pin it with a shared pointer, destroyed *after* slot is called.
-        auto all_data = std::make_shared<std::string>((char*)&length, 4);
-        *all_data += message;
-        output->write_all_async(all_data->data(), all_data->size(),
-            [this, all_data] (Glib::RefPtr<Gio::AsyncResult>& result)
+    send(std::move(message), nullptr);
+}
+
+uint64_t WayfireIPC::send(std::string message, response_handler cb, int client_id, int timeout_ms,
+    IPCLane lane)
+{
+    if (!connected)
+    {
+        return 0;
+    }
+
+    auto stats = &method_stats[std::string(method_name(message))];
+    stats->requests++;
+    stats->bytes_out += sizeof(uint32_t) + message.size();
+
+    // Every queued message has its pending request at the same position
+    // from the end, so a message and its request are reordered together
+    size_t position = send_message(std::move(message), lane);
+    auto request    = pending_requests.insert(
+        pending_requests.end() - (write_queue.size() - 1) + position, pending_request_t{});
+
+    uint64_t token = next_request_token++;
+    request->token     = token;
+    request->client_id = client_id;
+    request->handler   = std::move(cb);
+    request->lane = lane;
+    request->stats     = stats;
+    request->queued_at = std::chrono::steady_clock::now();
+
+    if (timeout_ms > 0)
+    {
+        request->timeout = Glib::signal_timeout().connect([this, token] ()
         {
-            try {
-                gsize written;
-                auto success = output->write_all_finish(result, written);
-                if (!success)
-                {
-                    LOGE("IPC error: write failed. Bytes written: ", written);
-                }
+            expire_request(token);
+            return false;
+        }, timeout_ms);
+    }
 
-                this->writing = false;
-                if (!cancel->is_cancelled())
-                {
-                    write_next();
-                }
-            } catch (const Glib::Error& e)
-            {
-                this->writing = false;
-                if (e.code() == G_IO_ERROR_CANCELLED)
-                {
-                    // Intended behavior
-                    return;
-                } else
-                {
-                    LOGE("IPC error: write failed: ", e.what());
-                }
-            }
-        }, cancel);
-    } catch (const Gio::Error& e)
+    return token;
+}
+
+WayfireIPC::pending_request_t*WayfireIPC::find_request(uint64_t token)
+{
+    for (auto& request : pending_requests)
     {
-        LOGE("IPC error: ", e.what());
+        if (request.token == token)
+        {
+            return &request;
+        }
     }
+
+    return nullptr;
+}
+
+void WayfireIPC::cancel_request(uint64_t token)
+{
+    // The entry stays queued, its reply still has to be consumed in order
+    if (auto request = find_request(token))
+    {
+        request->handler = nullptr;
+        request->timeout.disconnect();
+    }
+}
+
+void WayfireIPC::expire_request(uint64_t token)
+{
+    auto request = find_request(token);
+    if (!request || !request->handler)
+    {
+        return;
+    }
+
+    auto handler = std::move(request->handler);
+    request->handler = nullptr;
+
+    wf::json_t error;
+    error["error"] = "timeout";
+    handler(error);
+}
+
+size_t WayfireIPC::send_message(std::string message, IPCLane lane)
+{
+    size_t position = write_queue.size();
+    if (lane == IPCLane::INTERACTIVE)
+    {
+        // Ahead of all bulk messages, except one which is partly written
+        position = std::min<size_t>((write_offset > 0) ? 1 : 0, write_queue.size());
+        while ((position < write_queue.size()) && (write_queue[position].lane == IPCLane::INTERACTIVE))
+        {
+            position++;
+        }
+    }
+
+    uint32_t length = message.size();
+    write_queue.insert(write_queue.begin() + position, {length, std::move(message), lane});
+    if (writing)
+    {
+        return position;
+    }
+
+    // Everything sent until the socket is polled goes out in one batch
+    writing = true;
+    write_connection = Glib::signal_io().connect(
+        sigc::mem_fun(*this, &WayfireIPC::send_queue),
+        connection->get_socket()->get_fd(),
+        Glib::IOCondition::IO_OUT);
+    return position;
 }
 
 bool WayfireIPC::send_queue(Glib::IOCondition cond)
 {
-    if (write_queue.empty())
+    if (!flush_write_queue())
     {
-        writing = false;
+        connection_lost();
         return false;
     }
 
-    auto message = write_queue.front();
-    write_queue.pop();
+    if (!write_queue.empty())
+    {
+        // The socket is full, wait until it is writable again
+        return true;
+    }
 
-    write_stream(message);
+    writing = false;
     return false;
 }
 
-bool WayfireIPC::receive(Glib::IOCondition cond)
+bool WayfireIPC::flush_write_queue()
 {
-    try {
-        ssize_t received = 0;
-        uint32_t length;
-
-        // TODO: Input buffer can(?) contain incomplete message
-        while (connection->get_socket()->get_available_bytes() > 0)
+    int fd = connection->get_socket()->get_fd();
+    while (!write_queue.empty())
+    {
+        // Length prefixes and bodies are written in place, without copying
+        // them into one buffer first
+        write_iov.clear();
+        size_t skip = write_offset;
+        for (auto& message : write_queue)
         {
-            received = input->read(&length, sizeof(length));
-            if (received == -1)
+            if (write_iov.size() + 2 > IOV_MAX)
             {
-                LOGE("IPC error: Receive message length failed");
-                return false;
+                break;
             }
 
-            if (received == 0)
+            std::pair<const char*, size_t> parts[2] = {
+                {(const char*)&message.length, sizeof(message.length)},
+                {message.body.data(), message.body.size()},
+            };
+            for (auto& [data, size] : parts)
             {
-                LOGE("IPC error: Disconnected");
-                return false;
-            }
+                if (skip >= size)
+                {
+                    skip -= size;
+                    continue;
+                }
 
-            if (received != sizeof(length))
-            {
-                LOGE("IPC error: failed to read message. Expected (bytes): ",
-                    sizeof(length),
-                    ", was read (bytes)",
-                    received);
-                return false;
+                write_iov.push_back({(void*)(data + skip), size - skip});
+                skip = 0;
             }
+        }
 
-            std::string buf(length, 0);
-            received = input->read(&buf[0], length);
-            if (received == -1)
+        msghdr msg{};
+        msg.msg_iov    = write_iov.data();
+        msg.msg_iovlen = write_iov.size();
+        ssize_t written = ::sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written == -1)
+        {
+            if (errno == EINTR)
             {
-                LOGE("IPC error: receive message body failed");
-                return false;
+                continue;
             }
 
-            if (received == 0)
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
             {
-                LOGE("IPC error: Disconnected");
-                return false;
+                return true;
             }
 
-            if (received != length)
-            {
-                LOGE("IPC error: failed to read message. Expected (bytes): ",
-                    length,
-                    ", was read (bytes)",
-                    received);
-                return false;
-            }
+            LOGE("IPC error: write failed: ", strerror(errno));
+            return false;
+        }
 
-            wf::json_t message;
-            auto err = wf::json_t::parse_string(buf, message);
-            if (err.has_value())
+        // Drop what was written completely, remember how far the rest got
+        size_t done = write_offset + written;
+        while (!write_queue.empty())
+        {
+            size_t size = sizeof(uint32_t) + write_queue.front().body.size();
+            if (done < size)
             {
-                LOGE("IPC error: JSON parse: ", err.value(), " message: ", buf, " length: ", buf.length());
-                return false;
+                break;
             }
 
-            if (message.has_member("event"))
-            {
-                for (auto subscriber : subscribers)
-                {
-                    subscriber->on_event(message);
-                }
+            done -= size;
+            write_queue.pop_front();
+        }
 
-                if (subscriptions.find(message["event"]) != subscriptions.end())
-                {
-                    for (auto sub : subscriptions[message["event"]])
-                    {
-                        sub->on_event(message);
-                    }
-                }
-            } else
-            {
-                auto handler = response_handlers.front();
-                response_handlers.pop();
-                auto client = clients.find(handler);
-                if (client != clients.end())
-                {
-                    client->second->handle_response(message);
-                }
-            }
+        write_offset = done;
+    }
+
+    return true;
+}
+
+bool WayfireIPC::receive(Glib::IOCondition cond)
+{
+    auto status = read_buffer.read_from(connection->get_socket()->get_fd());
+    if (status == IPCFrameBuffer::READ_ERROR)
+    {
+        LOGE("IPC error: receive failed: ", strerror(errno));
+        connection_lost();
+        return false;
+    }
+
+    if (status == IPCFrameBuffer::READ_DISCONNECTED)
+    {
+        LOGE("IPC error: Disconnected");
+        connection_lost();
+        return false;
+    }
+
+    std::string_view buf;
+    while (read_buffer.next_frame(buf))
+    {
+        if (!handle_message(buf))
+        {
+            // The stream cannot be resynchronized after a bad frame
+            connection_lost();
+            return false;
+        }
+    }
+
+    flush_events();
+    return true;
+}
+
+bool WayfireIPC::receive_frames(Glib::IOCondition cond)
+{
+    if (!dispatch_frames(reader.get()))
+    {
+        return false;
+    }
+
+    if (reader)
+    {
+        reader->drained();
+    }
+
+    flush_events();
+    return true;
+}
+
+bool WayfireIPC::dispatch_frames(WayfireIPCReader *from)
+{
+    WayfireIPCReader::frame_t frame;
+    while (from->pop(frame))
+    {
+        if (frame.failed)
+        {
+            LOGE("IPC error: ", frame.error);
+            connection_lost();
+            return false;
         }
-    } catch (const Gio::Error& e)
+
+        bool live = (from == reader.get());
+        handle_parsed(std::move(frame.message), frame.bytes, frame.parse_us);
+        if (!connected || (live && (from != reader.get())))
+        {
+            // A handler dropped the connection or stopped the reader, which
+            // took care of the remaining frames
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool WayfireIPC::handle_message(const std::string_view& buf)
+{
+    wf::json_t message;
+    auto start = std::chrono::steady_clock::now();
+    auto err   = wf::json_t::parse_string(buf, message);
+    if (err.has_value())
     {
-        LOGE("IPC error: ", e.what());
+        LOGE("IPC error: JSON parse: ", err.value(), " message: ", buf, " length: ", buf.length());
         return false;
     }
 
+    handle_parsed(std::move(message), buf.size(), elapsed_us(start));
     return true;
 }
 
-void WayfireIPC::subscribe_all(IIPCSubscriber *subscriber)
+void WayfireIPC::handle_parsed(wf::json_t message, size_t bytes, uint64_t parse_us)
 {
-    subscribers.insert(subscriber);
+    if (message.has_member("event"))
+    {
+        queue_event(std::move(message), bytes, parse_us);
+        return;
+    }
+
+    // Keep the order of events and responses as they were received
+    flush_events();
+    if (pending_requests.empty())
+    {
+        LOGE("IPC error: unexpected response: ", message.serialize());
+        return;
+    }
 
-    wf::json_t new_subs;
-    new_subs["method"] = "window-rules/events/watch";
-    send(new_subs.serialize());
+    // The compositor answers in order, so the reply belongs to the oldest
+    // request. Cancelled and timed out requests still own their slot.
+    auto request = std::move(pending_requests.front());
+    pending_requests.pop_front();
+    request.timeout.disconnect();
+
+    uint64_t latency_us = elapsed_us(request.queued_at);
+    auto& stats = lane_stats[(int)request.lane];
+    stats.requests++;
+    stats.total_ms += latency_us / 1000.0;
+    stats.max_ms    = std::max(stats.max_ms, latency_us / 1000.0);
+
+    auto method = request.stats;
+    method->bytes_in += bytes;
+    method->parse_us += parse_us;
+    method->latency_us[latency_bucket(latency_us)]++;
+    if (request.handler)
+    {
+        auto start = std::chrono::steady_clock::now();
+        request.handler(std::move(message));
+        method->dispatch_us += elapsed_us(start);
+    }
 }
 
-void WayfireIPC::subscribe(IIPCSubscriber *subscriber, const std::vector<std::string>& events)
+int WayfireIPC::intern_event(const std::string& event)
 {
-    wf::json_t new_subs;
-    new_subs["method"] = "window-rules/events/watch";
-    new_subs["events"] = wf::json_t::array();
+    auto it = event_ids.find(event);
+    if (it != event_ids.end())
+    {
+        return it->second;
+    }
 
-    for (auto event : events)
+    int id = event_routes.size();
+    event_ids[event] = id;
+    event_routes.emplace_back();
+    event_routes.back().kind = ipc_event_kind_from_name(event);
+    return id;
+}
+
+void WayfireIPC::update_event_routes()
+{
+    for (auto& [event, subs] : subscriptions)
     {
-        if (subscriptions.find(event) == subscriptions.end())
+        auto& route = event_routes[intern_event(event)];
+        route.subscribers.assign(subscribers.begin(), subscribers.end());
+        for (auto sub : subs)
         {
-            new_subs["events"].append(event);
-            subscriptions[event] = std::set<IIPCSubscriber*>();
+            if (!subscribers.count(sub))
+            {
+                route.subscribers.push_back(sub);
+            }
         }
 
-        subscriptions[event].insert(subscriber);
+        // Only merge if every subscriber of this event agreed to it
+        auto& coalescing = coalesced_subscriptions[event];
+        route.coalesce = subscribers.empty() && !subs.empty();
+        for (auto sub : subs)
+        {
+            route.coalesce &= (coalescing.count(sub) > 0);
+        }
+    }
+}
+
+void WayfireIPC::queue_event(wf::json_t message, size_t bytes, uint64_t parse_us)
+{
+    auto name  = message["event"].as_string();
+    auto stats = &event_stats[name];
+    stats->received++;
+    stats->bytes_in += bytes;
+    stats->parse_us += parse_us;
+
+    auto it = event_ids.find(name);
+    int id  = (it == event_ids.end()) ? -1 : it->second;
+    if ((id < 0) || !event_routes[id].coalesce)
+    {
+        pending_events.push_back({id, std::move(message), stats});
+        return;
+    }
+
+    uint32_t view_id = UINT32_MAX;
+    if (message.has_member("view") && message["view"].is_object() && message["view"].has_member("id"))
+    {
+        view_id = message["view"]["id"].as_int();
+    }
+
+    uint64_t key = ((uint64_t)id << 32) | view_id;
+    auto pending = pending_event_index.find(key);
+    if (pending != pending_event_index.end())
+    {
+        // Latest wins and moves to the end of the queue, so that it is not
+        // delivered before other events of the view received after the older one
+        pending_events[pending->second].dropped = true;
+        stats->coalesced++;
+    }
+
+    pending_event_index[key] = pending_events.size();
+    pending_events.push_back({id, std::move(message), stats});
+}
+
+void WayfireIPC::flush_events()
+{
+    if (pending_events.empty())
+    {
+        return;
+    }
+
+    auto events = std::move(pending_events);
+    pending_events.clear();
+    pending_event_index.clear();
+
+    for (auto& event : events)
+    {
+        if (event.dropped)
+        {
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        dispatch_event(event.id, event.message);
+        event.stats->dispatch_us += elapsed_us(start);
+    }
+}
+
+void WayfireIPC::dispatch_event(int id, const wf::json_t& message)
+{
+    // A subscriber may unsubscribe itself or others while the event is
+    // delivered, so it goes to a copy of the list, skipping those gone since
+    std::vector<IIPCSubscriber*> targets;
+    if (id < 0)
+    {
+        targets.assign(subscribers.begin(), subscribers.end());
+    } else
+    {
+        targets = event_routes[id].subscribers;
+    }
+
+    if (targets.empty())
+    {
+        return;
+    }
+
+    // Decoded once, whatever the number of subscribers
+    IPCEvent event((id < 0) ? ipc_event_kind_from_name(message["event"].as_string()) : event_routes[id].kind,
+        message);
+    size_t delivered = 0;
+    for (auto subscriber : targets)
+    {
+        if (is_subscribed(id, subscriber))
+        {
+            subscriber->on_event(event);
+            delivered++;
+        }
+    }
+
+    // Each subscriber after the first would have decoded its own copy
+    if (delivered > 1)
+    {
+        event_copies_saved += delivered - 1;
     }
+}
 
-    if (new_subs["events"].size() > 0)
+bool WayfireIPC::is_subscribed(int id, IIPCSubscriber *subscriber) const
+{
+    if (id < 0)
     {
-        send(new_subs.serialize());
+        return subscribers.count(subscriber) > 0;
     }
+
+    auto& route = event_routes[id].subscribers;
+    return std::find(route.begin(), route.end(), subscriber) != route.end();
+}
+
+void WayfireIPC::update_watch()
+{
+    bool all = !subscribers.empty();
+    std::set<std::string> events;
+    for (auto& [event, subs] : subscriptions)
+    {
+        if (!subs.empty())
+        {
+            events.insert(event);
+        }
+    }
+
+    if (!all && events.empty() && !watch_sent)
+    {
+        // Nothing was asked for yet, so nothing is sent
+        return;
+    }
+
+    if (watch_sent && (all == watching_all) && (all || (events == watched_events)))
+    {
+        return;
+    }
+
+    // Each watch replaces the previous one of this connection
+    wf::json_t watch;
+    watch["method"] = "window-rules/events/watch";
+    if (!all)
+    {
+        watch["events"] = wf::json_t::array();
+        for (auto& event : events)
+        {
+            watch["events"].append(event);
+        }
+
+        // An empty list means all events to the compositor, a name which is
+        // never sent stops the events of the previous watch instead
+        if (events.empty())
+        {
+            watch["events"].append(IPC_NO_EVENTS);
+        }
+    }
+
+    send(watch.serialize());
+    watched_events = std::move(events);
+    watching_all   = all;
+    watch_sent     = true;
+}
+
+void WayfireIPC::subscribe_all(IIPCSubscriber *subscriber)
+{
+    subscribers.insert(subscriber);
+    update_event_routes();
+    update_watch();
+}
+
+void WayfireIPC::subscribe(IIPCSubscriber *subscriber, const std::vector<std::string>& events,
+    bool coalesce)
+{
+    for (auto& event : events)
+    {
+        subscriptions[event].insert(subscriber);
+        if (coalesce)
+        {
+            coalesced_subscriptions[event].insert(subscriber);
+        }
+    }
+
+    update_event_routes();
+    update_watch();
 }
 
 void WayfireIPC::unsubscribe(IIPCSubscriber *subscriber)
@@ -314,16 +835,31 @@ void WayfireIPC::unsubscribe(IIPCSubscriber *subscriber)
     {
         subs.erase(subscriber);
     }
+
+    for (auto& [_, subs] : coalesced_subscriptions)
+    {
+        subs.erase(subscriber);
+    }
+
+    update_event_routes();
+    update_watch();
 }
 
-std::shared_ptr<IPCClient> WayfireIPC::create_client()
+void WayfireIPC::unsubscribe(IIPCSubscriber *subscriber, const std::vector<std::string>& events)
 {
-    if (!connected)
+    for (auto& event : events)
     {
-        std::cerr << "Failed to create ipc client" << std::endl;
-        return std::shared_ptr<IPCClient>(new IPCClient(0, shared_from_this()));
+        subscriptions[event].erase(subscriber);
+        coalesced_subscriptions[event].erase(subscriber);
     }
 
+    update_event_routes();
+    update_watch();
+}
+
+std::shared_ptr<IPCClient> WayfireIPC::create_client()
+{
+    // Also while not connected yet, the client works once the connection is up
     auto client = new IPCClient(next_client_id, shared_from_this());
     clients[next_client_id++] = client;
 
@@ -339,6 +875,80 @@ std::shared_ptr<IPCClient> WayfireIPC::create_client()
 void WayfireIPC::client_destroyed(int id)
 {
     clients.erase(id);
+
+    // Replies for a destroyed client are dropped, not looked up
+    for (auto& request : pending_requests)
+    {
+        if (request.client_id == id)
+        {
+            request.handler = nullptr;
+            request.timeout.disconnect();
+        }
+    }
+}
+
+/* A default constructed json_t is null, which would be dumped for no entries */
+static wf::json_t empty_json_object()
+{
+    wf::json_t object;
+    wf::json_t::parse_string("{}", object);
+    return object;
+}
+
+std::string WayfireIPC::dump_stats() const
+{
+    wf::json_t dump;
+    dump["uptime-ms"] = (uint64_t)(elapsed_us(stats_start) / 1000);
+
+    for (auto lane : {IPCLane::INTERACTIVE, IPCLane::BULK})
+    {
+        auto& stats = get_lane_stats(lane);
+        wf::json_t entry;
+        entry["requests"] = stats.requests;
+        entry["total-ms"] = stats.total_ms;
+        entry["max-ms"]   = stats.max_ms;
+        dump["lanes"][(lane == IPCLane::INTERACTIVE) ? "interactive" : "bulk"] = entry;
+    }
+
+    dump["methods"] = empty_json_object();
+    for (auto& [name, stats] : method_stats)
+    {
+        wf::json_t entry;
+        entry["requests"]    = stats.requests;
+        entry["bytes-out"]   = stats.bytes_out;
+        entry["bytes-in"]    = stats.bytes_in;
+        entry["parse-us"]    = stats.parse_us;
+        entry["dispatch-us"] = stats.dispatch_us;
+
+        // Trailing empty buckets are left out
+        int last = IPC_LATENCY_BUCKETS - 1;
+        while ((last >= 0) && (stats.latency_us[last] == 0))
+        {
+            last--;
+        }
+
+        entry["latency-log2-us"] = wf::json_t::array();
+        for (int i = 0; i <= last; i++)
+        {
+            entry["latency-log2-us"].append(stats.latency_us[i]);
+        }
+
+        dump["methods"][name] = entry;
+    }
+
+    dump["events"] = empty_json_object();
+    for (auto& [name, stats] : event_stats)
+    {
+        wf::json_t entry;
+        entry["received"]    = stats.received;
+        entry["coalesced"]   = stats.coalesced;
+        entry["bytes-in"]    = stats.bytes_in;
+        entry["parse-us"]    = stats.parse_us;
+        entry["dispatch-us"] = stats.dispatch_us;
+        dump["events"][name] = entry;
+    }
+
+    return dump.serialize();
 }
 
 std::shared_ptr<WayfireIPC> WayfireIPC::get_instance()
@@ -361,27 +971,30 @@ IPCClient::~IPCClient()
     ipc->client_destroyed(id);
 }
 
-void IPCClient::send(const std::string& message)
+void IPCClient::send(std::string message)
 {
-    ipc->send(message);
+    ipc->send(std::move(message));
 }
 
-void IPCClient::send(const std::string& message, response_handler cb)
+uint64_t IPCClient::send(std::string message, response_handler cb, int timeout_ms)
 {
-    response_handlers.push(cb);
-    ipc->send(message, id);
+    return ipc->send(std::move(message), std::move(cb), id, timeout_ms);
 }
 
-void IPCClient::handle_response(wf::json_t response)
+uint64_t IPCClient::send_interactive(std::string message, response_handler cb, int timeout_ms)
 {
-    auto handler = response_handlers.front();
-    response_handlers.pop();
-    handler(response);
+    return ipc->send(std::move(message), std::move(cb), id, timeout_ms, IPCLane::INTERACTIVE);
 }
 
-void IPCClient::subscribe(IIPCSubscriber *subscriber, const std::vector<std::string>& events)
+void IPCClient::cancel(uint64_t token)
 {
-    ipc->subscribe(subscriber, events);
+    ipc->cancel_request(token);
+}
+
+void IPCClient::subscribe(IIPCSubscriber *subscriber, const std::vector<std::string>& events,
+    bool coalesce)
+{
+    ipc->subscribe(subscriber, events, coalesce);
 }
 
 void IPCClient::subscribe_all(IIPCSubscriber *subscriber)
@@ -393,3 +1006,8 @@ void IPCClient::unsubscribe(IIPCSubscriber *subscriber)
 {
     ipc->unsubscribe(subscriber);
 }
+
+void IPCClient::unsubscribe(IIPCSubscriber *subscriber, const std::vector<std::string>& events)
+{
+    ipc->unsubscribe(subscriber, events);
+}
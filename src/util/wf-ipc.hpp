@@ -2,81 +2,259 @@
 
 #include <glibmm.h>
 #include <giomm.h>
+#include <sys/uio.h>
 
 #include <sigc++/connection.h>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
-#include <queue>
 #include <set>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 #include <wayfire/nonstd/json.hpp>
 
+#include "wf-ipc-events.hpp"
+#include "wf-ipc-reader.hpp"
+
 class IIPCSubscriber
 {
   public:
-    virtual void on_event(wf::json_t) = 0;
+    /* The event is decoded once and shared by all subscribers, copy what
+     * should outlive the call */
+    virtual void on_event(const IPCEvent& event) = 0;
+    /* The connection was lost and is back, with all subscriptions restored.
+     * Events in between are lost, so cached state should be requested again. */
+    virtual void on_reconnected()
+    {}
 };
 
 using response_handler = std::function<void (wf::json_t)>;
 
+/* Interactive messages are written before queued bulk ones */
+enum class IPCLane
+{
+    INTERACTIVE,
+    BULK,
+};
+
+/* Bucket i of a latency histogram counts [2^i, 2^(i+1)) microseconds */
+static constexpr int IPC_LATENCY_BUCKETS = 24;
+
+struct IPCMethodStats
+{
+    uint64_t requests  = 0;
+    uint64_t bytes_out = 0;
+    uint64_t bytes_in  = 0;
+    uint64_t latency_us[IPC_LATENCY_BUCKETS] = {};
+    /* Parsing the replies and running their callbacks */
+    uint64_t parse_us    = 0;
+    uint64_t dispatch_us = 0;
+};
+
+struct IPCEventStats
+{
+    uint64_t received = 0;
+    /* Replaced by a newer event of the same view before being delivered */
+    uint64_t coalesced = 0;
+    uint64_t bytes_in  = 0;
+    uint64_t parse_us  = 0;
+    /* Delivering to all subscribers */
+    uint64_t dispatch_us = 0;
+};
+
+struct IPCLaneStats
+{
+    uint64_t requests = 0;
+    /* From queueing the request until its reply was received */
+    double total_ms = 0;
+    double max_ms   = 0;
+};
+
 class WayfireIPC;
 class IPCClient
 {
   private:
     int id;
     std::shared_ptr<WayfireIPC> ipc;
-    std::queue<response_handler> response_handlers;
 
   public:
     IPCClient(int id, std::shared_ptr<WayfireIPC> ipc) : id(id), ipc(ipc)
     {}
+    /* Pending replies of this client are dropped */
     ~IPCClient();
-    void handle_response(wf::json_t response);
-    void send(const std::string& message);
-    void send(const std::string& message, response_handler cb);
-    void subscribe(IIPCSubscriber *subscriber, const std::vector<std::string>& events);
+    void send(std::string message);
+    /**
+     * Send a request, cb is called with its reply. If timeout_ms is positive
+     * and no reply arrived in time, cb is called with {"error": "timeout"}
+     * instead and the late reply is discarded.
+     *
+     * @return A token for cancel(), 0 if the request could not be sent
+     */
+    uint64_t send(std::string message, response_handler cb, int timeout_ms = 0);
+    /* Same as send(), for requests the user is waiting for, like a click.
+     * They skip ahead of queued bulk requests. */
+    uint64_t send_interactive(std::string message, response_handler cb = nullptr, int timeout_ms = 0);
+    /* The callback of the request will not be called anymore */
+    void cancel(uint64_t token);
+    /**
+     * Subscribe to the given events. With coalesce set, the subscriber
+     * declares that only the newest of several events with the same name and
+     * view id, received during one main loop iteration, matters to it.
+     */
+    void subscribe(IIPCSubscriber *subscriber, const std::vector<std::string>& events,
+        bool coalesce = false);
     void subscribe_all(IIPCSubscriber *subscriber);
     void unsubscribe(IIPCSubscriber *subscriber);
+    /* Stop receiving only the given events, the others stay subscribed */
+    void unsubscribe(IIPCSubscriber *subscriber, const std::vector<std::string>& events);
 };
 
 class WayfireIPC : public std::enable_shared_from_this<WayfireIPC>
 {
   private:
-    std::queue<int> response_handlers;
+    /* Requests in the order they were sent, which is the order of replies */
+    struct pending_request_t
+    {
+        uint64_t token;
+        int client_id;
+        response_handler handler;
+        sigc::connection timeout;
+        IPCLane lane = IPCLane::BULK;
+        IPCMethodStats *stats = nullptr;
+        std::chrono::steady_clock::time_point queued_at;
+    };
+    std::deque<pending_request_t> pending_requests;
+    uint64_t next_request_token = 1;
+    IPCLaneStats lane_stats[2];
+    /* Node-based maps, requests and events point into them */
+    std::unordered_map<std::string, IPCMethodStats> method_stats;
+    std::unordered_map<std::string, IPCEventStats> event_stats;
+    std::chrono::steady_clock::time_point stats_start = std::chrono::steady_clock::now();
     std::set<IIPCSubscriber*> subscribers;
+    /* Subscribers per event, the compositor only sends the events with at
+     * least one of them */
     std::unordered_map<std::string, std::set<IIPCSubscriber*>> subscriptions;
+    std::unordered_map<std::string, std::set<IIPCSubscriber*>> coalesced_subscriptions;
+
+    /* Interned event names, each with its precomputed list of receivers,
+     * subscribe_all subscribers included */
+    struct event_route_t
+    {
+        IPCEventKind kind = IPCEventKind::UNKNOWN;
+        std::vector<IIPCSubscriber*> subscribers;
+        bool coalesce = false;
+    };
+    std::unordered_map<std::string, int> event_ids;
+    std::vector<event_route_t> event_routes;
+
+    /* What the compositor was last asked to send */
+    std::set<std::string> watched_events;
+    bool watching_all = false;
+    bool watch_sent   = false;
+
+    /* Events received in the current dispatch, flushed once it is done */
+    struct pending_event_t
+    {
+        int id;
+        wf::json_t message;
+        IPCEventStats *stats;
+        /* Superseded by a newer event coalesced with it */
+        bool dropped = false;
+    };
+    std::vector<pending_event_t> pending_events;
+    std::unordered_map<uint64_t, size_t> pending_event_index;
     int next_client_id{1};
     std::unordered_map<int, IPCClient*> clients;
-    sigc::connection sig_connection;
+    sigc::connection read_connection;
+    sigc::connection write_connection;
+    sigc::connection reconnect_timer;
+    static constexpr int RECONNECT_MIN_DELAY_MS = 100;
+    static constexpr int RECONNECT_MAX_DELAY_MS = 10000;
+    int reconnect_delay_ms = RECONNECT_MIN_DELAY_MS;
     Glib::RefPtr<Gio::SocketConnection> connection;
-    Glib::RefPtr<Gio::InputStream> input;
-    Glib::RefPtr<Gio::OutputStream> output;
-    Glib::RefPtr<Gio::Cancellable> cancel;
-    std::queue<std::string> write_queue;
+
+    /* Messages waiting for the socket, flushed together on IO_OUT */
+    struct outgoing_message_t
+    {
+        uint32_t length;
+        std::string body;
+        IPCLane lane;
+    };
+    std::deque<outgoing_message_t> write_queue;
+    /* Bytes of the first queued message already written */
+    size_t write_offset = 0;
+    std::vector<iovec> write_iov;
     bool writing = false;
 
+    /* Incoming bytes when reading on the main thread */
+    IPCFrameBuffer read_buffer;
+    /* Reads and parses on its own thread instead, if enabled */
+    std::unique_ptr<WayfireIPCReader> reader;
+    sigc::connection reader_connection;
+    bool use_reader_thread = false;
+
     bool connect();
     void disconnect();
-    void send_message(const std::string& message);
+    void connection_lost();
+    void schedule_reconnect();
+    void try_reconnect();
+    /* @return The position the message was queued at */
+    size_t send_message(std::string message, IPCLane lane);
     bool send_queue(Glib::IOCondition cond);
+    bool flush_write_queue();
+    void start_receiving();
+    void start_reader();
+    void stop_reader(bool dispatch_queued);
     bool receive(Glib::IOCondition cond);
-    void write_stream(const std::string& message);
-    void write_next();
+    bool receive_frames(Glib::IOCondition cond);
+    bool dispatch_frames(WayfireIPCReader *from);
+    bool handle_message(const std::string_view& buf);
+    void handle_parsed(wf::json_t message, size_t bytes, uint64_t parse_us);
+    int intern_event(const std::string& event);
+    void update_event_routes();
+    void update_watch();
+    void queue_event(wf::json_t message, size_t bytes, uint64_t parse_us);
+    void flush_events();
+    void dispatch_event(int id, const wf::json_t& message);
+    /* False once the subscriber left the route of the event, -1 for unrouted ones */
+    bool is_subscribed(int id, IIPCSubscriber *subscriber) const;
+    pending_request_t *find_request(uint64_t token);
+    void expire_request(uint64_t token);
 
   public:
-    void send(const std::string& message);
-    void send(const std::string& message, int response_handler);
-    void subscribe(IIPCSubscriber *subscriber, const std::vector<std::string>& events);
+    void send(std::string message);
+    uint64_t send(std::string message, response_handler cb, int client_id = 0, int timeout_ms = 0,
+        IPCLane lane = IPCLane::BULK);
+    void cancel_request(uint64_t token);
+    void subscribe(IIPCSubscriber *subscriber, const std::vector<std::string>& events,
+        bool coalesce = false);
     void subscribe_all(IIPCSubscriber *subscriber);
     void unsubscribe(IIPCSubscriber *subscriber);
+    void unsubscribe(IIPCSubscriber *subscriber, const std::vector<std::string>& events);
     std::shared_ptr<IPCClient> create_client();
     void client_destroyed(int id);
+    const IPCLaneStats& get_lane_stats(IPCLane lane) const
+    {
+        return lane_stats[(int)lane];
+    }
+
+    /* Request, event and lane statistics since startup as compact JSON */
+    std::string dump_stats() const;
+
+    /* Move reading and JSON parsing of incoming messages off the main
+     * thread. Events and replies are still delivered on the main loop,
+     * in the same order. */
+    void set_reader_thread(bool enabled);
 
     static std::shared_ptr<WayfireIPC> get_instance();
     bool connected = false;
+    /* Event deliveries that used to deep-copy the message per subscriber */
+    uint64_t event_copies_saved = 0;
     WayfireIPC();
     ~WayfireIPC();
 };